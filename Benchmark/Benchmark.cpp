@@ -0,0 +1,445 @@
+#include <CppInject/ServiceCollection.h>
+#include <CppInject/StaticServiceCollection.h>
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+using namespace CppInject;
+
+namespace DependencyInjectionBenchmark {
+
+struct SingletonService {
+  int value = 1;
+};
+
+/// <summary>
+/// A transient service at the given depth of a linear dependency chain
+/// </summary>
+template <size_t Depth>
+struct TransientNode {
+  std::shared_ptr<TransientNode<Depth - 1>> _dependency;
+  TransientNode(std::shared_ptr<TransientNode<Depth - 1>> dependency)
+      : _dependency(std::move(dependency)) {}
+};
+
+template <>
+struct TransientNode<0> {
+  int value = 0;
+};
+
+template <size_t... Depths>
+void addTransientChain(ServiceCollection& serviceCollection,
+                       std::index_sequence<Depths...>) {
+  (serviceCollection.addTransient<TransientNode<Depths>>(), ...);
+}
+
+struct IPlugin {
+  virtual ~IPlugin() = default;
+  virtual int value() const = 0;
+};
+
+template <size_t Index>
+struct Plugin : IPlugin {
+  int value() const override { return Index; }
+};
+
+template <size_t... Indices>
+void addPlugins(ServiceCollection& serviceCollection,
+                std::index_sequence<Indices...>) {
+  (serviceCollection.addSingleton<IPlugin, Plugin<Indices>>(), ...);
+}
+
+struct ScopedLeaf {
+  int value = 0;
+};
+
+struct ScopedService {
+  ScopedLeaf& _leaf;
+  SingletonService& _singleton;
+  ScopedService(ScopedLeaf& leaf, SingletonService& singleton)
+      : _leaf(leaf), _singleton(singleton) {}
+};
+
+static std::unique_ptr<IServiceProviderRoot> buildSingletonProvider() {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<SingletonService>();
+  return std::move(serviceCollection).build();
+}
+
+static void BM_GetServiceWarm(benchmark::State& state) {
+  auto sp = buildSingletonProvider();
+  sp->getService<SingletonService>();
+  for (auto _ : state)
+    benchmark::DoNotOptimize(sp->getService<SingletonService>());
+}
+BENCHMARK(BM_GetServiceWarm);
+
+static void BM_GetRequiredServiceWarm(benchmark::State& state) {
+  auto sp = buildSingletonProvider();
+  sp->getRequiredService<SingletonService>();
+  for (auto _ : state)
+    benchmark::DoNotOptimize(&sp->getRequiredService<SingletonService>());
+}
+BENCHMARK(BM_GetRequiredServiceWarm);
+
+static void BM_GetServiceCold(benchmark::State& state) {
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto sp = buildSingletonProvider();
+    state.ResumeTiming();
+    benchmark::DoNotOptimize(sp->getService<SingletonService>());
+    state.PauseTiming();
+    sp.reset();
+    state.ResumeTiming();
+  }
+}
+BENCHMARK(BM_GetServiceCold);
+
+static void BM_GetStaticService(benchmark::State& state) {
+  auto sp =
+      StaticServiceCollection<SingletonRegistration<SingletonService>>::build();
+  for (auto _ : state)
+    benchmark::DoNotOptimize(&sp->get<SingletonService>());
+}
+BENCHMARK(BM_GetStaticService);
+
+static void BM_GetStaticServiceById(benchmark::State& state) {
+  auto sp =
+      StaticServiceCollection<SingletonRegistration<SingletonService>>::build();
+  IServiceProviderRoot& serviceProvider = *sp;
+  for (auto _ : state)
+    benchmark::DoNotOptimize(serviceProvider.getService<SingletonService>());
+}
+BENCHMARK(BM_GetStaticServiceById);
+
+static void BM_GetKeyedService(benchmark::State& state) {
+  ServiceCollection serviceCollection;
+  addPlugins(serviceCollection, std::make_index_sequence<7>{});
+  serviceCollection.addSingleton<IPlugin, Plugin<7>>("plugin");
+  auto sp = std::move(serviceCollection).build();
+  for (auto _ : state)
+    benchmark::DoNotOptimize(sp->getService<IPlugin, "plugin">());
+}
+BENCHMARK(BM_GetKeyedService);
+
+static void BM_GetKeyedServiceByStoredKey(benchmark::State& state) {
+  ServiceCollection serviceCollection;
+  addPlugins(serviceCollection, std::make_index_sequence<7>{});
+  serviceCollection.addSingleton<IPlugin, Plugin<7>>("plugin");
+  auto sp = std::move(serviceCollection).build();
+  const ServiceKey key("plugin");
+  for (auto _ : state)
+    benchmark::DoNotOptimize(sp->getService<IPlugin>(key));
+}
+BENCHMARK(BM_GetKeyedServiceByStoredKey);
+
+template <size_t Depth>
+static void BM_GetTransientService(benchmark::State& state) {
+  ServiceCollection serviceCollection;
+  addTransientChain(serviceCollection, std::make_index_sequence<Depth + 1>{});
+  auto sp = std::move(serviceCollection).build();
+  for (auto _ : state)
+    benchmark::DoNotOptimize(sp->getTransientService<TransientNode<Depth>>());
+}
+BENCHMARK_TEMPLATE(BM_GetTransientService, 1);
+BENCHMARK_TEMPLATE(BM_GetTransientService, 4);
+BENCHMARK_TEMPLATE(BM_GetTransientService, 16);
+
+template <size_t NumberOfImplementations>
+static void BM_GetServices(benchmark::State& state) {
+  ServiceCollection serviceCollection;
+  addPlugins(serviceCollection,
+             std::make_index_sequence<NumberOfImplementations>{});
+  auto sp = std::move(serviceCollection).build();
+  sp->getServices<IPlugin>();
+  for (auto _ : state) benchmark::DoNotOptimize(sp->getServices<IPlugin>());
+}
+BENCHMARK_TEMPLATE(BM_GetServices, 1);
+BENCHMARK_TEMPLATE(BM_GetServices, 8);
+BENCHMARK_TEMPLATE(BM_GetServices, 64);
+
+template <size_t NumberOfImplementations>
+static void BM_GetServiceSpan(benchmark::State& state) {
+  ServiceCollection serviceCollection;
+  addPlugins(serviceCollection,
+             std::make_index_sequence<NumberOfImplementations>{});
+  auto sp = std::move(serviceCollection).build();
+  sp->getServiceSpan<IPlugin>();
+  for (auto _ : state) benchmark::DoNotOptimize(sp->getServiceSpan<IPlugin>());
+}
+BENCHMARK_TEMPLATE(BM_GetServiceSpan, 1);
+BENCHMARK_TEMPLATE(BM_GetServiceSpan, 8);
+BENCHMARK_TEMPLATE(BM_GetServiceSpan, 64);
+
+template <bool unique>
+static void BM_GetLeafTransientService(benchmark::State& state) {
+  ServiceCollection serviceCollection;
+  if constexpr (unique)
+    serviceCollection.addUniqueTransient<TransientNode<0>>();
+  else
+    serviceCollection.addTransient<TransientNode<0>>();
+  auto sp = std::move(serviceCollection).build();
+  for (auto _ : state) {
+    if constexpr (unique)
+      benchmark::DoNotOptimize(sp->getUniqueService<TransientNode<0>>());
+    else
+      benchmark::DoNotOptimize(sp->getTransientService<TransientNode<0>>());
+  }
+}
+BENCHMARK_TEMPLATE(BM_GetLeafTransientService, false);
+BENCHMARK_TEMPLATE(BM_GetLeafTransientService, true);
+
+// Expensive to construct, cheap to reset
+struct MessageBuffer {
+  std::vector<char> data = std::vector<char>(4096);
+  size_t size = 0;
+  void reset() { size = 0; }
+};
+
+template <bool pooled>
+static void BM_GetBufferService(benchmark::State& state) {
+  ServiceCollection serviceCollection;
+  if constexpr (pooled)
+    serviceCollection.addPooledTransient<MessageBuffer>(16);
+  else
+    serviceCollection.addTransient<MessageBuffer>();
+  auto sp = std::move(serviceCollection).build();
+  for (auto _ : state)
+    benchmark::DoNotOptimize(sp->getTransientService<MessageBuffer>());
+}
+BENCHMARK_TEMPLATE(BM_GetBufferService, false);
+BENCHMARK_TEMPLATE(BM_GetBufferService, true);
+
+static void BM_CreateScope(benchmark::State& state) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<SingletonService>();
+  serviceCollection.addScoped<ScopedLeaf>();
+  serviceCollection.addScoped<ScopedService>();
+  auto sp = std::move(serviceCollection).build();
+  const ScopeMode mode = state.range(0) != 0 ? ScopeMode::SingleThreaded
+                                             : ScopeMode::Concurrent;
+  for (auto _ : state) {
+    auto scope = sp->createScope(mode);
+    benchmark::DoNotOptimize(scope->getService<ScopedService>());
+  }
+}
+BENCHMARK(BM_CreateScope)->ArgName("singleThreaded")->Arg(0)->Arg(1);
+
+static void BM_GetSingletonFromScope(benchmark::State& state) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<SingletonService>();
+  ServiceProviderOptions options;
+  options.threadLocalSingletonCache = state.range(0) != 0;
+  auto sp = std::move(serviceCollection).build(options);
+  auto scope = sp->createScope();
+  scope->getService<SingletonService>();
+  for (auto _ : state)
+    benchmark::DoNotOptimize(scope->getService<SingletonService>());
+}
+BENCHMARK(BM_GetSingletonFromScope)
+    ->ArgName("threadLocalCache")
+    ->Arg(0)
+    ->Arg(1);
+
+static void BM_GetServiceThroughResolver(benchmark::State& state) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<SingletonService>();
+  serviceCollection.addScoped<ScopedLeaf>();
+  auto sp = std::move(serviceCollection).build();
+  auto scope = sp->createScope();
+  auto singleton = scope->getResolver<SingletonService>();
+  auto scoped = scope->getResolver<ScopedLeaf>();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(&singleton());
+    benchmark::DoNotOptimize(&scoped());
+  }
+}
+BENCHMARK(BM_GetServiceThroughResolver);
+
+template <size_t Index>
+struct HandlerService {
+  int value = Index;
+};
+
+template <bool batched, size_t... Indices>
+static void resolveHandlerServices(benchmark::State& state,
+                                   std::index_sequence<Indices...>) {
+  ServiceCollection serviceCollection;
+  (serviceCollection.addSingleton<HandlerService<Indices>>(), ...);
+  auto sp = std::move(serviceCollection).build();
+  auto scope = sp->createScope();
+  for (auto _ : state) {
+    if constexpr (batched) {
+      benchmark::DoNotOptimize(scope->resolve<HandlerService<Indices>...>());
+    } else {
+      (benchmark::DoNotOptimize(
+           scope->getRequiredService<HandlerService<Indices>>()),
+       ...);
+    }
+  }
+}
+
+template <bool batched>
+static void BM_ResolveHandlerServices(benchmark::State& state) {
+  resolveHandlerServices<batched>(state, std::make_index_sequence<10>{});
+}
+BENCHMARK_TEMPLATE(BM_ResolveHandlerServices, false);
+BENCHMARK_TEMPLATE(BM_ResolveHandlerServices, true);
+
+static void BM_GetServiceContended(benchmark::State& state) {
+  static const auto sp = buildSingletonProvider();
+  for (auto _ : state)
+    benchmark::DoNotOptimize(sp->getService<SingletonService>());
+}
+BENCHMARK(BM_GetServiceContended)->ThreadRange(1, 64)->UseRealTime();
+
+static void BM_CreateScopeContended(benchmark::State& state) {
+  static const auto sp = [] {
+    ServiceCollection serviceCollection;
+    serviceCollection.addSingleton<SingletonService>();
+    serviceCollection.addScoped<ScopedLeaf>();
+    serviceCollection.addScoped<ScopedService>();
+    return std::move(serviceCollection).build();
+  }();
+  for (auto _ : state) {
+    auto scope = sp->createScope();
+    benchmark::DoNotOptimize(scope->getService<ScopedService>());
+  }
+}
+BENCHMARK(BM_CreateScopeContended)->ThreadRange(1, 64)->UseRealTime();
+
+/// <summary>
+/// A request as a server handles it in its own scope: a scoped service, a
+/// singleton and a transient service
+/// </summary>
+struct RequestHandler {
+  ScopedService& _scoped;
+  std::shared_ptr<TransientNode<0>> _transient;
+  RequestHandler(ScopedService& scoped,
+                 std::shared_ptr<TransientNode<0>> transient)
+      : _scoped(scoped), _transient(std::move(transient)) {}
+};
+
+/// <summary>
+/// Counts latencies in buckets that are 1/32 of a power of two wide, so the
+/// memory does not grow with the number of samples and histograms of
+/// different threads can be added
+/// </summary>
+class LatencyHistogram {
+  static constexpr uint64_t subBuckets = 32;
+  static constexpr int maxShift = 40;
+  std::array<uint64_t, (maxShift + 2) * subBuckets> _counts{};
+  uint64_t _total = 0;
+
+  // Latencies below 2 * subBuckets have a bucket each, larger ones are
+  // shifted until they are below 2 * subBuckets
+  static size_t bucketOf(uint64_t ns) {
+    if (ns < 2 * subBuckets) return ns;
+    const int shift =
+        std::min(static_cast<int>(std::bit_width(ns)) - 6, maxShift);
+    return std::min<uint64_t>(subBuckets * shift + (ns >> shift),
+                              std::tuple_size_v<decltype(_counts)> - 1);
+  }
+
+  // The lower bound of the bucket
+  static uint64_t valueOf(size_t bucket) {
+    if (bucket < 2 * subBuckets) return bucket;
+    const int shift = static_cast<int>(bucket / subBuckets) - 1;
+    return (bucket - subBuckets * shift) << shift;
+  }
+
+ public:
+  void record(std::chrono::nanoseconds latency) {
+    ++_counts[bucketOf(static_cast<uint64_t>(latency.count()))];
+    ++_total;
+  }
+
+  void add(const LatencyHistogram& other) {
+    for (size_t i = 0; i < _counts.size(); ++i) _counts[i] += other._counts[i];
+    _total += other._total;
+  }
+
+  uint64_t total() const { return _total; }
+
+  uint64_t percentile(double fraction) const {
+    const auto rank =
+        static_cast<uint64_t>(fraction * static_cast<double>(_total - 1));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < _counts.size(); ++i) {
+      seen += _counts[i];
+      if (seen > rank) return valueOf(i);
+    }
+    return valueOf(_counts.size() - 1);
+  }
+};
+
+/// <summary>
+/// Adds the latencies of the calling thread to those of the other threads of
+/// the benchmark. The last thread reports the percentiles of all samples.
+/// </summary>
+static void reportLatencies(benchmark::State& state,
+                            const LatencyHistogram& latencies) {
+  static std::mutex mutex;
+  static LatencyHistogram merged;
+  static int reportedThreads = 0;
+  std::lock_guard lock(mutex);
+  merged.add(latencies);
+  if (++reportedThreads < state.threads()) return;
+  if (merged.total() > 0) {
+    // only this thread sets the counters, so their sum is the value
+    state.counters["p50_ns"] = static_cast<double>(merged.percentile(0.5));
+    state.counters["p99_ns"] = static_cast<double>(merged.percentile(0.99));
+    state.counters["p99.9_ns"] =
+        static_cast<double>(merged.percentile(0.999));
+  }
+  merged = LatencyHistogram{};
+  reportedThreads = 0;
+}
+
+// Sweeps the thread count over a mix of scope churn and singleton, scoped and
+// transient resolutions, see "Benchmarks" in the readme for comparing runs.
+// Reading the clock costs about as much as a request, so only every
+// latencySampleInterval-th request is timed.
+static void BM_HandleRequestsContended(benchmark::State& state) {
+  static const auto sp = [] {
+    ServiceCollection serviceCollection;
+    serviceCollection.addSingleton<SingletonService>();
+    serviceCollection.addScoped<ScopedLeaf>();
+    serviceCollection.addScoped<ScopedService>();
+    serviceCollection.addTransient<TransientNode<0>>();
+    serviceCollection.addScoped<RequestHandler>();
+    return std::move(serviceCollection).build();
+  }();
+  constexpr size_t latencySampleInterval = 16;
+  const auto handleRequest = [] {
+    auto scope = sp->createScope();
+    benchmark::DoNotOptimize(scope->getService<RequestHandler>());
+    benchmark::DoNotOptimize(scope->getService<SingletonService>());
+  };
+  LatencyHistogram latencies;
+  size_t request = 0;
+  for (auto _ : state) {
+    if (++request % latencySampleInterval != 0) {
+      handleRequest();
+      continue;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    handleRequest();
+    latencies.record(std::chrono::steady_clock::now() - start);
+  }
+  state.SetItemsProcessed(state.iterations());
+  reportLatencies(state, latencies);
+}
+BENCHMARK(BM_HandleRequestsContended)->ThreadRange(1, 64)->UseRealTime();
+
+}  // namespace DependencyInjectionBenchmark
+
+BENCHMARK_MAIN();
@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""Compares two Google Benchmark JSON outputs, e.g. baseline.json with a new
+run, and exits with 1 if a benchmark regressed by more than the threshold.
+
+    python3 compare.py baseline.json contender.json [--threshold 0.1]
+
+Only the standard library is used, so no packages have to be installed. If
+the runs have repetitions, their medians are compared.
+"""
+
+import argparse
+import json
+import sys
+
+# Metrics where smaller is better, and where larger is better
+LATENCIES = ("real_time", "p50_ns", "p99_ns", "p99.9_ns")
+THROUGHPUTS = ("items_per_second",)
+
+NANOSECONDS = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+
+def load(path):
+    with open(path, encoding="utf-8") as file:
+        benchmarks = json.load(file)["benchmarks"]
+    has_medians = any(b.get("aggregate_name") == "median" for b in benchmarks)
+    results = {}
+    for benchmark in benchmarks:
+        if has_medians:
+            if benchmark.get("aggregate_name") != "median":
+                continue
+            name = benchmark["run_name"]
+        else:
+            if benchmark.get("run_type", "iteration") != "iteration":
+                continue
+            name = benchmark["name"]
+        metrics = dict(benchmark)
+        metrics["real_time"] = benchmark["real_time"] * NANOSECONDS[
+            benchmark.get("time_unit", "ns")]
+        results[name] = metrics
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline")
+    parser.add_argument("contender")
+    parser.add_argument("--threshold", type=float, default=0.1,
+                        help="relative change that counts as a regression")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    contender = load(args.contender)
+    regressions = 0
+    print(f"{'Benchmark':<56} {'Metric':<17} {'Baseline':>12} "
+          f"{'Contender':>12} {'Change':>8}")
+    for name, old in baseline.items():
+        new = contender.get(name)
+        if new is None:
+            print(f"{name:<56} missing in {args.contender}")
+            continue
+        for metric in LATENCIES + THROUGHPUTS:
+            if metric not in old or metric not in new or old[metric] == 0:
+                continue
+            change = new[metric] / old[metric] - 1
+            worse = -change if metric in THROUGHPUTS else change
+            regressed = worse > args.threshold
+            regressions += regressed
+            print(f"{name:<56} {metric:<17} {old[metric]:>12.4g} "
+                  f"{new[metric]:>12.4g} {change:>+8.1%}"
+                  f"{'  REGRESSION' if regressed else ''}")
+    print(f"{regressions} regression(s) above {args.threshold:.0%}")
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace CppInject::detail {
+
+/// <summary>
+/// A lock-free, append-only log with a fixed capacity.
+/// <para/>
+/// Appending claims an index with a single atomic increment. Appends that
+/// happen after each other (e.g. the creation of a dependency and the
+/// creation of the service depending on it) keep their order in the log.
+/// </summary>
+template <class T>
+class AppendLog {
+  std::unique_ptr<T[]> _entries;
+  std::atomic<size_t> _size{0};
+
+ public:
+  /// <summary>
+  /// Create an empty log
+  /// </summary>
+  /// <param name="capacity">The maximum number of entries</param>
+  inline explicit AppendLog(size_t capacity)
+      : _entries(std::make_unique<T[]>(capacity)) {}
+
+  /// <summary>
+  /// Append an entry. The log must not be full.
+  /// </summary>
+  /// <returns>The index of the entry</returns>
+  inline size_t push(T entry) {
+    const size_t index = _size.fetch_add(1, std::memory_order_relaxed);
+    _entries[index] = std::move(entry);
+    return index;
+  }
+
+  /// <summary>
+  /// Append an entry without an atomic read-modify-write. The log must not be
+  /// full and no other thread may append concurrently.
+  /// </summary>
+  /// <returns>The index of the entry</returns>
+  inline size_t pushUnsynchronized(T entry) {
+    const size_t index = _size.load(std::memory_order_relaxed);
+    _entries[index] = std::move(entry);
+    _size.store(index + 1, std::memory_order_relaxed);
+    return index;
+  }
+
+  /// <summary>
+  /// Access an entry that has been appended. Must not be called concurrently
+  /// with the append of this entry or with popAll.
+  /// </summary>
+  inline T& at(size_t index) { return _entries[index]; }
+
+  /// <summary>
+  /// Visit all entries from the last to the first one and reset each of them
+  /// after it has been visited. Must not be called concurrently with push.
+  /// </summary>
+  /// <param name="visit">(T&amp;) -&gt; void</param>
+  template <class F>
+  inline void popAll(F&& visit) {
+    for (size_t i = _size.load(std::memory_order_relaxed); i > 0; --i) {
+      visit(_entries[i - 1]);
+      _entries[i - 1] = T{};
+      _size.store(i - 1, std::memory_order_relaxed);
+    }
+  }
+};
+}  // namespace CppInject::detail
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+
+namespace CppInject::detail {
+
+/// <summary>
+/// A thread-safe bump allocator. Memory is only released as a whole by reset or
+/// when the arena is destroyed.
+/// <para/>
+/// Allocations bump the offset of the current block with a single atomic
+/// add. Only allocations that do not fit into the current block take a lock to
+/// chain a new block.
+/// </summary>
+class Arena {
+  struct Block {
+    Block* previous;
+    size_t capacity;
+    std::atomic<size_t> used{0};
+
+    inline std::byte* data() { return reinterpret_cast<std::byte*>(this + 1); }
+  };
+
+  const size_t _blockSize;
+  std::atomic<Block*> _current{nullptr};
+  std::mutex _growMutex;
+
+  inline static void freeBlocks(Block* block) {
+    while (block != nullptr) {
+      Block* previous = block->previous;
+      block->~Block();
+      ::operator delete(block);
+      block = previous;
+    }
+  }
+
+  inline void grow(Block* full, size_t minimumCapacity) {
+    std::scoped_lock lock{_growMutex};
+    if (_current.load(std::memory_order_relaxed) != full) return;
+    const size_t capacity = std::max(
+        full == nullptr ? _blockSize : full->capacity * 2, minimumCapacity);
+    Block* block = new (::operator new(sizeof(Block) + capacity)) Block{};
+    block->previous = full;
+    block->capacity = capacity;
+    _current.store(block, std::memory_order_release);
+  }
+
+ public:
+  /// <summary>
+  /// Create an empty arena. The first block is allocated on first use.
+  /// </summary>
+  /// <param name="blockSize">The size of the first block in bytes, following
+  /// blocks double in size</param>
+  inline explicit Arena(size_t blockSize) : _blockSize(blockSize) {}
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+  inline ~Arena() { freeBlocks(_current.load(std::memory_order_relaxed)); }
+
+  /// <summary>
+  /// Allocate memory that lives until the arena is reset or destroyed.
+  /// </summary>
+  inline void* allocate(size_t size, size_t alignment) {
+    const size_t reserved = size + alignment - 1;
+    while (true) {
+      Block* block = _current.load(std::memory_order_acquire);
+      if (block != nullptr) {
+        const size_t offset =
+            block->used.fetch_add(reserved, std::memory_order_relaxed);
+        if (offset + reserved <= block->capacity) {
+          void* memory = block->data() + offset;
+          size_t space = reserved;
+          return std::align(alignment, size, memory, space);
+        }
+      }
+      grow(block, reserved);
+    }
+  }
+
+  /// <summary>
+  /// Get the number of bytes allocated by the arena, including the headers of
+  /// its blocks. Must not be called concurrently with reset.
+  /// </summary>
+  inline size_t capacity() const {
+    size_t bytes = 0;
+    for (const Block* block = _current.load(std::memory_order_acquire);
+         block != nullptr; block = block->previous)
+      bytes += sizeof(Block) + block->capacity;
+    return bytes;
+  }
+
+  /// <summary>
+  /// Release all allocations, keeping the largest block for reuse. Must not be
+  /// called concurrently with allocate.
+  /// </summary>
+  inline void reset() {
+    Block* current = _current.load(std::memory_order_relaxed);
+    if (current == nullptr) return;
+    freeBlocks(current->previous);
+    current->previous = nullptr;
+    current->used.store(0, std::memory_order_relaxed);
+  }
+};
+
+/// <summary>
+/// A standard allocator that allocates from an Arena and never deallocates.
+/// </summary>
+template <class T>
+class ArenaAllocator {
+  template <class U>
+  friend class ArenaAllocator;
+  Arena* _arena;
+
+ public:
+  using value_type = T;
+
+  inline explicit ArenaAllocator(Arena& arena) : _arena(&arena) {}
+  template <class U>
+  inline ArenaAllocator(const ArenaAllocator<U>& other)
+      : _arena(other._arena) {}
+
+  inline T* allocate(size_t n) {
+    return static_cast<T*>(_arena->allocate(n * sizeof(T), alignof(T)));
+  }
+  inline void deallocate(T*, size_t) {}
+
+  template <class U>
+  inline bool operator==(const ArenaAllocator<U>& other) const {
+    return _arena == other._arena;
+  }
+};
+}  // namespace CppInject::detail
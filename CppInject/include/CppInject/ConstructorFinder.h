@@ -1,13 +1,26 @@
 #pragma once
 
+#include <cstddef>
+#include <memory>
 #include <tuple>
 #include <type_traits>
 
 namespace CppInject {
+
+/// <summary>
+/// Lists the constructor arguments of a class, see Inject.
+/// </summary>
+template <class... Args>
+struct Ctor {};
+
 namespace detail {
 template <class T>
 T& pretendToCreateAnything();
 
+// The largest number of constructor arguments that is probed
+inline constexpr size_t maxConstructorArgs = 32;
+inline constexpr size_t noConstructorFound = ~size_t{0};
+
 template <typename T, int ArgIndex>
 struct OverloadResolutionHelper {
   friend auto& functionWithReturnTypeOfArg(
@@ -26,11 +39,18 @@ struct FunctionWithReturnTypeOfArgWrapper {
   }
 };
 
+template <typename T>
+inline constexpr bool isUniquePointer = false;
+
+template <typename T, typename D>
+inline constexpr bool isUniquePointer<std::unique_ptr<T, D>> = true;
+
 // The templated conversion operator is enabled for the correct argument using
-// SFINAE
+// SFINAE. Overload resolution prefers the lvalue conversion, which would pick
+// the deleted copy constructor of a unique_ptr argument.
 template <typename T, int ArgIndex>
 struct ToConstructorArgTypeConvertible {
-  template <typename TArg,
+  template <typename TArg, std::enable_if_t<!isUniquePointer<TArg>, int> = 0,
             int = sizeof(FunctionWithReturnTypeOfArgWrapper<T, TArg, ArgIndex>)>
   operator TArg&();
   template <typename TArg,
@@ -52,8 +72,11 @@ template <typename T, int... ArgIndices>
 constexpr size_t numberOfConstructorArgsIntern(
     char) {  // overload resolution will disfavor this overload when called with
              // 0
-  return numberOfConstructorArgsIntern<T, ArgIndices..., sizeof...(ArgIndices)>(
-      0);
+  if constexpr (sizeof...(ArgIndices) == maxConstructorArgs)
+    return noConstructorFound;
+  else
+    return numberOfConstructorArgsIntern<T, ArgIndices...,
+                                         sizeof...(ArgIndices)>(0);
 }
 
 template <typename T, typename U>
@@ -66,26 +89,75 @@ struct ConstructorArgsAsTupleIntern<T,
       std::tuple<std::remove_reference_t<decltype(functionWithReturnTypeOfArg(
           OverloadResolutionHelper<T, ArgIndices>{}))>...>;
 };
+
+template <typename TInject>
+struct InjectArguments {
+  static_assert(sizeof(TInject) == 0, "Inject must be a Ctor<Args...>");
+};
+
+template <typename... Args>
+struct InjectArguments<Ctor<Args...>> {
+  using TupleType =
+      std::tuple<std::remove_cv_t<std::remove_reference_t<Args>>...>;
+};
+
+// Deduces the constructor arguments once per class: the friend injection of
+// ConstructorArgsAsTupleIntern is only instantiated for classes that do not
+// declare Inject.
+template <typename T, typename = void>
+struct ConstructorTraits {
+  static constexpr size_t arity = numberOfConstructorArgsIntern<T>(0);
+  static_assert(arity != noConstructorFound,
+                "No constructor found, declare the constructor arguments with "
+                "using Inject = CppInject::Ctor<Args...>.");
+  using Arguments = typename ConstructorArgsAsTupleIntern<
+      T, std::make_integer_sequence<
+             int, arity == noConstructorFound ? 0 : static_cast<int>(arity)>>::
+      TupleType;
+};
+
+template <typename T, typename... Args>
+constexpr bool isConstructibleFrom(Ctor<Args...>*) {
+  return std::is_constructible_v<T, Args...>;
+}
+
+// Inject is not a Ctor, reported by InjectArguments
+template <typename T>
+constexpr bool isConstructibleFrom(...) {
+  return true;
+}
+
+template <typename T>
+struct ConstructorTraits<T, std::void_t<typename T::Inject>> {
+  static_assert(
+      isConstructibleFrom<T>(static_cast<typename T::Inject*>(nullptr)),
+      "The arguments declared by Inject do not match a constructor. "
+      "Note that derived classes inherit the Inject declaration.");
+  using Arguments = typename InjectArguments<typename T::Inject>::TupleType;
+  static constexpr size_t arity = std::tuple_size_v<Arguments>;
+};
 }  // namespace detail
 
 /// <summary>
 /// Get the number of arguments of a constructor
 /// </summary>
 /// <typeparam name="T">The type of the class with the constructor</typeparam>
-/// <returns>The number of arguments of the constructor with the lowest number
-/// of arguments</returns>
+/// <returns>The number of arguments declared by T::Inject, or of the
+/// constructor with the lowest number of arguments</returns>
 template <typename T>
 constexpr auto numberOfConstructorArgs() {
-  return detail::numberOfConstructorArgsIntern<T>(0);
+  return detail::ConstructorTraits<T>::arity;
 }
 
 /// <summary>
 /// Get constructor arguments as a tuple.
 /// Note that qualifiers and references are dropped.
+/// <para/>
+/// Classes can declare the arguments with
+/// using Inject = CppInject::Ctor&lt;Args...&gt;, which skips the deduction
+/// and selects a constructor other than the one with the fewest arguments.
 /// </summary>
 /// <typeparam name="T"></typeparam>
 template <typename T>
-using ConstructorArgsAsTuple = typename detail::ConstructorArgsAsTupleIntern<
-    T,
-    std::make_integer_sequence<int, numberOfConstructorArgs<T>()>>::TupleType;
+using ConstructorArgsAsTuple = typename detail::ConstructorTraits<T>::Arguments;
 }  // namespace CppInject
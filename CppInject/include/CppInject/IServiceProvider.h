@@ -1,11 +1,174 @@
 #pragma once
 
+#include <algorithm>
 #include <any>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <future>
+#include <iterator>
 #include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
 #include <typeindex>
+#include <unordered_map>
 #include <vector>
 
+#include "Instrumentation.h"
+#include "OnceCell.h"
+
 namespace CppInject {
+namespace detail {
+// The ids of the service types and keys of this module, see IdDomain
+struct IdRegistry {
+  std::mutex mutex;
+  std::unordered_map<std::type_index, size_t> typeIds;
+  std::vector<std::type_index> types;
+  std::unordered_map<std::string, size_t> keyIds;
+  std::vector<const std::string*> keyNames;
+
+  inline static IdRegistry& instance() {
+    static IdRegistry registry;
+    return registry;
+  }
+};
+
+/// <summary>
+/// Get the dense id of a service type in this module, assigned once per type.
+/// Ids start at 1. Takes a lock, so it should not be called on hot paths -
+/// see serviceTypeId.
+/// </summary>
+inline size_t internServiceType(std::type_index type) {
+  auto& registry = IdRegistry::instance();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  const auto [it, added] =
+      registry.typeIds.try_emplace(type, registry.types.size() + 1);
+  if (added) registry.types.push_back(type);
+  return it->second;
+}
+
+/// <summary>
+/// Get the dense id of a service key in this module, assigned once per name.
+/// Ids start at 1. Takes a lock, so it should not be called on hot paths.
+/// </summary>
+inline size_t internKey(std::string_view name) {
+  auto& registry = IdRegistry::instance();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  const auto [it, added] = registry.keyIds.try_emplace(
+      std::string(name), registry.keyNames.size() + 1);
+  if (added) registry.keyNames.push_back(&it->first);
+  return it->second;
+}
+
+inline std::type_index serviceTypeOf(size_t typeId) {
+  auto& registry = IdRegistry::instance();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  return registry.types.at(typeId - 1);
+}
+
+inline std::string_view keyNameOf(size_t keyId) {
+  auto& registry = IdRegistry::instance();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  return *registry.keyNames.at(keyId - 1);
+}
+
+/// <summary>
+/// The ids of service types and keys are assigned by the module that uses
+/// them. Modules that do not share inline variables, e.g. the DLLs of a
+/// process on Windows, number them independently, so the same id can stand
+/// for different types in different modules.
+/// <para/>
+/// Each module has its own IdDomain, which maps its ids back to types and key
+/// names that another module can intern. Service providers record the domain
+/// of their ids and translate the ids of other domains.
+/// </summary>
+struct IdDomain {
+  std::type_index (*typeOf)(size_t typeId);
+  std::string_view (*keyNameOf)(size_t keyId);
+};
+
+/// <summary>
+/// The IdDomain of the calling module. Only its address is compared.
+/// </summary>
+inline const IdDomain* idDomain() {
+  static constexpr IdDomain domain{&serviceTypeOf, &keyNameOf};
+  return &domain;
+}
+
+template <class T>
+size_t serviceTypeIdOf() {
+  static const size_t id = internServiceType(typeid(T));
+  return id;
+}
+
+/// <summary>
+/// A dense id of a service type, assigned once per type. Ids start at 1, the
+/// value is 0 only while static initialization has not reached it yet.
+/// <para/>
+/// Ids are unique within a module, see IdDomain.
+/// </summary>
+template <class T>
+inline const size_t serviceTypeId = serviceTypeIdOf<T>();
+
+template <class T>
+inline size_t getServiceTypeId() {
+  using Type = std::remove_cv_t<T>;
+  const size_t id = serviceTypeId<Type>;
+  return id != 0 ? id : serviceTypeIdOf<Type>();
+}
+
+/// <summary>
+/// A service key that is known at compile time
+/// </summary>
+template <size_t N>
+struct KeyLiteral {
+  char value[N];
+  constexpr KeyLiteral(const char (&name)[N]) {
+    std::copy_n(name, N, value);
+  }
+  constexpr std::string_view view() const { return {value, N - 1}; }
+};
+
+template <KeyLiteral Key>
+size_t keyIdOf() {
+  static const size_t id = internKey(Key.view());
+  return id;
+}
+
+template <KeyLiteral Key>
+inline const size_t keyId = keyIdOf<Key>();
+
+template <KeyLiteral Key>
+inline size_t getKeyId() {
+  const size_t id = keyId<Key>;
+  return id != 0 ? id : keyIdOf<Key>();
+}
+}  // namespace detail
+
+/// <summary>
+/// The key of a keyed registration. Creating a key interns its name, which
+/// takes a lock, so keys used on hot paths should be stored or known at
+/// compile time - see IServiceProvider::getService&lt;TService, Key&gt;.
+/// </summary>
+class ServiceKey {
+  size_t _id;
+
+ public:
+  ServiceKey(std::string_view name) : _id(detail::internKey(name)) {}
+  ServiceKey(const char* name) : ServiceKey(std::string_view(name)) {}
+  ServiceKey(const std::string& name) : ServiceKey(std::string_view(name)) {}
+
+  /// <summary>
+  /// The dense id of the key, see ServiceCollection::ServiceTable
+  /// </summary>
+  size_t id() const { return _id; }
+};
 
 /// <summary>
 /// The type of the collection of services that is returned when requesting
@@ -15,11 +178,213 @@ namespace CppInject {
 template <class TService>
 using ServiceVector = std::vector<std::reference_wrapper<TService>>;
 
+class IServiceProvider;
+
+/// <summary>
+/// A view of singleton and scoped services of one type, cached by the service
+/// provider that returned it. The view stays valid as long as that service
+/// provider or scope exists.
+/// </summary>
+/// <typeparam name="TService">The type of the services</typeparam>
+template <class TService>
+class ServiceSpan {
+  std::span<void* const> _services;
+
+ public:
+  using element_type = TService;
+
+  class iterator {
+    void* const* _service = nullptr;
+
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = TService;
+    using difference_type = std::ptrdiff_t;
+    using pointer = TService*;
+    using reference = TService&;
+
+    iterator() = default;
+    explicit iterator(void* const* service) : _service(service) {}
+    TService& operator*() const { return *static_cast<TService*>(*_service); }
+    TService* operator->() const { return static_cast<TService*>(*_service); }
+    iterator& operator++() {
+      ++_service;
+      return *this;
+    }
+    iterator operator++(int) { return iterator(_service++); }
+    bool operator==(const iterator& other) const = default;
+  };
+
+  ServiceSpan() = default;
+  /// <param name="services">Pointers to the services, already adjusted to
+  /// TService</param>
+  explicit ServiceSpan(std::span<void* const> services)
+      : _services(services) {}
+
+  size_t size() const { return _services.size(); }
+  bool empty() const { return _services.empty(); }
+  TService& operator[](size_t index) const {
+    return *static_cast<TService*>(_services[index]);
+  }
+  iterator begin() const { return iterator(_services.data()); }
+  iterator end() const {
+    return iterator(_services.data() + _services.size());
+  }
+};
+
+namespace detail {
+/// <summary>
+/// A singleton that is created by an asynchronous factory, owned by its
+/// service provider - see ServiceCollection::addAsyncSingleton.
+/// </summary>
+class AsyncInstance {
+ public:
+  /// <summary>
+  /// Wait until the instance has been created and get the service. Rethrows
+  /// the exception of the factory.
+  /// </summary>
+  virtual void* get() = 0;
+  virtual void wait() const = 0;
+  virtual std::future_status waitFor(
+      std::chrono::nanoseconds timeout) const = 0;
+
+ protected:
+  ~AsyncInstance() = default;
+};
+
+// A service that is either available or still created by an AsyncInstance
+struct PendingService {
+  AsyncInstance* pending;
+  void* service;
+};
+}  // namespace detail
+
+/// <summary>
+/// A singleton or scoped service that may still be created asynchronously -
+/// see IServiceProvider::getServiceAsync. Valid as long as the service
+/// provider exists.
+/// </summary>
+/// <typeparam name="T">The type of the service</typeparam>
+template <class T>
+class ServiceFuture {
+  detail::PendingService _service;
+
+ public:
+  explicit ServiceFuture(detail::PendingService service) : _service(service) {}
+
+  /// <summary>
+  /// Wait until the service is available and get it. Rethrows the exception
+  /// of an asynchronous factory.
+  /// </summary>
+  /// <returns>A pointer to the service, or a nullptr if the service is not
+  /// available</returns>
+  T* get() const {
+    return static_cast<T*>(_service.pending != nullptr
+                               ? _service.pending->get()
+                               : _service.service);
+  }
+
+  bool isReady() const {
+    return _service.pending == nullptr ||
+           _service.pending->waitFor(std::chrono::nanoseconds{0}) ==
+               std::future_status::ready;
+  }
+
+  void wait() const {
+    if (_service.pending != nullptr) _service.pending->wait();
+  }
+
+  template <class Rep, class Period>
+  std::future_status waitFor(
+      const std::chrono::duration<Rep, Period>& timeout) const {
+    if (_service.pending == nullptr) return std::future_status::ready;
+    return _service.pending->waitFor(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(timeout));
+  }
+};
+
+namespace detail {
+// The state of a Resolver: the cell that holds the service once it has been
+// created, and the function that creates it through the service provider
+// that owns the cell
+struct ResolverSlot {
+  const OnceCell* cell = nullptr;
+  IServiceProvider* serviceProvider = nullptr;
+  const void* dependency = nullptr;
+  void* (*resolve)(IServiceProvider& serviceProvider,
+                   const void* dependency) = nullptr;
+};
+}  // namespace detail
+
+/// <summary>
+/// A handle to a singleton or scoped service that resolves it without a
+/// virtual call or a lookup of its registration - see
+/// IServiceProvider::getResolver. The life-time and implementation of the
+/// service are decided when the handle is created, so resolving an existing
+/// instance is a single load.
+/// <para/>
+/// Valid as long as the service provider or scope that created it. Can be
+/// called concurrently if that service provider can be used concurrently.
+/// </summary>
+/// <typeparam name="TService">The type of the service</typeparam>
+template <class TService>
+class Resolver {
+  detail::ResolverSlot _slot;
+
+ public:
+  using element_type = TService;
+
+  /// <summary>
+  /// Create a handle to a service that is not available
+  /// </summary>
+  Resolver() = default;
+  explicit Resolver(detail::ResolverSlot slot) : _slot(slot) {}
+
+  /// <summary>
+  /// Check whether the service is available. Unavailable services must not
+  /// be resolved.
+  /// </summary>
+  explicit operator bool() const { return _slot.resolve != nullptr; }
+
+  /// <summary>
+  /// Get the service, creating it if it does not exist yet
+  /// </summary>
+  TService& operator()() const {
+    // instrumented builds count every resolution
+#ifndef CPPINJECT_INSTRUMENTATION
+    if (void* service = _slot.cell->tryGet())
+      return *static_cast<TService*>(service);
+#endif
+    return *static_cast<TService*>(
+        _slot.resolve(*_slot.serviceProvider, _slot.dependency));
+  }
+};
+
 /// <summary>
 /// Holds singleton and scoped service instances and allows creation of
 /// services and access to existing services.
 /// </summary>
 class IServiceProvider {
+  // The domain of the ids this service provider was built with, see
+  // detail::IdDomain
+  const detail::IdDomain* const _idDomain = detail::idDomain();
+
+ protected:
+  // The id of a type in the domain of this service provider. Callers in other
+  // modules translate their types by a lookup.
+  template <class T>
+  size_t typeIdOf() {
+    if (_idDomain == detail::idDomain()) return detail::getServiceTypeId<T>();
+    return getServiceTypeId(typeid(std::remove_cv_t<T>));
+  }
+
+  // The id of a key of the calling module in the domain of this service
+  // provider
+  size_t keyIdOf(size_t keyId) {
+    if (_idDomain == detail::idDomain() || keyId == 0) return keyId;
+    return getKeyId(detail::keyNameOf(keyId));
+  }
+
  public:
   virtual ~IServiceProvider() = default;
 
@@ -42,6 +407,158 @@ class IServiceProvider {
   /// services - see ServiceVector.</returns>
   virtual std::vector<std::any> getServices(std::type_index type) = 0;
 
+  /// <summary>
+  /// Get a singleton or scoped service by the id of its type.
+  /// <para/>
+  /// If multiple implementations have been registered for this service, the
+  /// last added service is provided.
+  /// </summary>
+  /// <param name="typeId">The id of the type of the service to get - see
+  /// detail::serviceTypeId</param>
+  /// <returns>A pointer to the service, already adjusted to the service type,
+  /// or a nullptr if the service is not available.</returns>
+  virtual void* getServiceById(size_t typeId) = 0;
+
+  /// <summary>
+  /// Get singleton and scoped services by the id of their type.
+  /// </summary>
+  /// <param name="typeId">The id of the type of the services - see
+  /// detail::serviceTypeId</param>
+  /// <returns>Pointers to the services, already adjusted to the service
+  /// type.</returns>
+  virtual std::vector<void*> getServicesById(size_t typeId) = 0;
+
+  /// <summary>
+  /// Get singleton and scoped services by the id of their type, without
+  /// allocating after the first call for a type.
+  /// </summary>
+  /// <param name="typeId">The id of the type of the services - see
+  /// detail::serviceTypeId</param>
+  /// <returns>Pointers to the services, already adjusted to the service type,
+  /// valid as long as this service provider exists.</returns>
+  virtual std::span<void* const> getServiceSpanById(size_t typeId) = 0;
+
+  /// <summary>
+  /// Create a transient service by the id of its type.
+  /// <para/>
+  /// If multiple implementations have been registered for this service, the
+  /// last added service is provided.
+  /// </summary>
+  /// <param name="typeId">The id of the shared_ptr type of the service - see
+  /// detail::serviceTypeId</param>
+  /// <returns>A shared_ptr to the service, already adjusted to the service
+  /// type, or a nullptr if the service is not available.</returns>
+  virtual std::shared_ptr<void> getTransientServiceById(size_t typeId) = 0;
+
+  /// <summary>
+  /// Create transient services by the id of their type.
+  /// </summary>
+  /// <param name="typeId">The id of the shared_ptr type of the services - see
+  /// detail::serviceTypeId</param>
+  /// <returns>shared_ptrs to the services, already adjusted to the service
+  /// type.</returns>
+  virtual std::vector<std::shared_ptr<void>> getTransientServicesById(
+      size_t typeId) = 0;
+
+  /// <summary>
+  /// Create a transient service that is owned by the caller by the id of its
+  /// type - see ServiceCollection::addUniqueTransient.
+  /// <para/>
+  /// If multiple implementations have been registered for this service, the
+  /// last added service is provided.
+  /// </summary>
+  /// <param name="typeId">The id of the unique_ptr type of the service - see
+  /// detail::serviceTypeId</param>
+  /// <returns>A pointer to the service, already adjusted to the service type,
+  /// that must be deleted as the service type, or a nullptr if the service is
+  /// not available.</returns>
+  virtual void* createUniqueServiceById(size_t typeId) = 0;
+
+  /// <summary>
+  /// Get a keyed singleton or scoped service by the id of its type and key.
+  /// </summary>
+  /// <param name="typeId">The id of the type of the service - see
+  /// detail::serviceTypeId</param>
+  /// <param name="keyId">The id of the key - see ServiceKey</param>
+  /// <returns>A pointer to the service, already adjusted to the service
+  /// type, or a nullptr if the service is not available.</returns>
+  virtual void* getKeyedServiceById(size_t typeId, size_t keyId) = 0;
+
+  /// <summary>
+  /// Create a keyed transient service by the id of its type and key.
+  /// </summary>
+  /// <param name="typeId">The id of the shared_ptr type of the service - see
+  /// detail::serviceTypeId</param>
+  /// <param name="keyId">The id of the key - see ServiceKey</param>
+  /// <returns>A shared_ptr to the service, already adjusted to the service
+  /// type, or a nullptr if the service is not available.</returns>
+  virtual std::shared_ptr<void> getKeyedTransientServiceById(size_t typeId,
+                                                             size_t keyId) = 0;
+
+  /// <summary>
+  /// Get a singleton or scoped service by the id of its type without waiting
+  /// for an asynchronous factory. Services that are not created
+  /// asynchronously are resolved before this returns.
+  /// </summary>
+  /// <param name="typeId">The id of the type of the service - see
+  /// detail::serviceTypeId</param>
+  /// <returns>The AsyncInstance that creates the service, or a pointer to the
+  /// service, already adjusted to the service type</returns>
+  virtual detail::PendingService getServiceAsyncById(size_t typeId) = 0;
+
+  /// <summary>
+  /// Get singleton and scoped services by the ids of their types in one
+  /// call.
+  /// </summary>
+  /// <param name="typeIds">The ids of the types of the services - see
+  /// detail::serviceTypeId</param>
+  /// <param name="services">Receives a pointer to each service, already
+  /// adjusted to the service type, or a nullptr if the service is not
+  /// available. Must be as large as typeIds.</param>
+  virtual void resolveByIds(std::span<const size_t> typeIds,
+                            std::span<void*> services) = 0;
+
+  /// <summary>
+  /// Get the number of bytes allocated by the service provider for its own
+  /// bookkeeping: the instance slots, the creation order, the service sets
+  /// and the memory of its arena. The root service provider also counts its
+  /// registrations and the scopes in its pool, which must not be created or
+  /// used concurrently. Instances that are not allocated from an arena are not
+  /// counted.
+  /// </summary>
+  /// <returns>An estimate of the allocated bytes, including the size of the
+  /// service provider itself</returns>
+  virtual size_t memoryUsage() const = 0;
+
+  /// <summary>
+  /// Get the state of a Resolver for a singleton or scoped service by the id
+  /// of its type.
+  /// <para/>
+  /// If multiple implementations have been registered for this service, the
+  /// last added service is resolved.
+  /// </summary>
+  /// <param name="typeId">The id of the type of the service - see
+  /// detail::serviceTypeId</param>
+  /// <returns>The state of the resolver, without a resolve function if the
+  /// service is not available</returns>
+  virtual detail::ResolverSlot getResolverById(size_t typeId) = 0;
+
+  /// <summary>
+  /// Get the id of a service type in the numbering of this service provider,
+  /// for callers in modules that number types on their own - see
+  /// detail::IdDomain.
+  /// </summary>
+  /// <param name="type">The type of the service, e.g. std::shared_ptr of the
+  /// service for transient services</param>
+  /// <returns>The id of the type, or 0 if the type is not registered</returns>
+  virtual size_t getServiceTypeId(std::type_index type) = 0;
+
+  /// <summary>
+  /// Get the id of a service key in the numbering of this service provider,
+  /// see getServiceTypeId. Takes a lock.
+  /// </summary>
+  virtual size_t getKeyId(std::string_view name) = 0;
+
   /// <summary>
   /// Get a singleton or scoped service.
   /// <para/>
@@ -53,10 +570,7 @@ class IServiceProvider {
   /// available</returns>
   template <typename TService>
   TService* getService() {
-    auto res = getService(std::type_index(typeid(TService)));
-    if (res.has_value())
-      return &std::any_cast<std::reference_wrapper<TService>>(res).get();
-    return nullptr;
+    return static_cast<TService*>(getServiceById(typeIdOf<TService>()));
   }
 
   /// <summary>
@@ -78,6 +592,138 @@ class IServiceProvider {
             " has not been registered as a singleton or scoped service."});
   }
 
+  /// <summary>
+  /// Get multiple singleton or scoped services with a single call and fail
+  /// if any of them is not available.
+  /// <para/>
+  /// If multiple implementations have been registered for a service, the
+  /// last added service is provided.
+  /// </summary>
+  /// <typeparam name="TServices">The types of the requested
+  /// services</typeparam>
+  /// <returns>A tuple of references to the services</returns>
+  template <typename... TServices>
+  std::tuple<TServices&...> resolve() {
+    constexpr size_t count = sizeof...(TServices);
+    const std::array<size_t, count> typeIds{typeIdOf<TServices>()...};
+    std::array<void*, count> services{};
+    resolveByIds(typeIds, services);
+    const std::array<const char*, count> names{typeid(TServices).name()...};
+    for (size_t i = 0; i < count; ++i)
+      if (services[i] == nullptr)
+        throw std::logic_error(
+            names[i] +
+            std::string{
+                " has not been registered as a singleton or scoped service."});
+    return [&]<size_t... Indices>(std::index_sequence<Indices...>) {
+      return std::tuple<TServices&...>(
+          *static_cast<TServices*>(services[Indices])...);
+    }(std::index_sequence_for<TServices...>{});
+  }
+
+  /// <summary>
+  /// Get a handle that resolves a singleton or scoped service without a
+  /// virtual call, for callers that resolve the same service repeatedly.
+  /// <para/>
+  /// If multiple implementations have been registered for this service, the
+  /// last added service is resolved.
+  /// </summary>
+  /// <typeparam name="TService">The type of the requested service</typeparam>
+  /// <returns>The handle, valid as long as this service provider exists. It
+  /// evaluates to false if the service is not available.</returns>
+  template <typename TService>
+  Resolver<TService> getResolver() {
+    return Resolver<TService>(getResolverById(typeIdOf<TService>()));
+  }
+
+  /// <summary>
+  /// Get a singleton or scoped service without blocking on a singleton that
+  /// is being created by an asynchronous factory.
+  /// <para/>
+  /// If multiple implementations have been registered for this service, the
+  /// last added service is provided.
+  /// </summary>
+  /// <typeparam name="TService">The type of the requested service</typeparam>
+  /// <returns>The service, which may still be created</returns>
+  template <typename TService>
+  ServiceFuture<TService> getServiceAsync() {
+    return ServiceFuture<TService>(getServiceAsyncById(typeIdOf<TService>()));
+  }
+
+  /// <summary>
+  /// Get a keyed singleton or scoped service.
+  /// </summary>
+  /// <typeparam name="TService">The type of the requested service</typeparam>
+  /// <param name="key">The key the service has been registered with</param>
+  /// <returns>A pointer to the service, or a nullptr if the service is not
+  /// available</returns>
+  template <typename TService>
+  TService* getService(const ServiceKey& key) {
+    return static_cast<TService*>(
+        getKeyedServiceById(typeIdOf<TService>(), keyIdOf(key.id())));
+  }
+
+  /// <summary>
+  /// Get a keyed singleton or scoped service with a key that is known at
+  /// compile time. Costs the same as an unkeyed lookup.
+  /// </summary>
+  /// <typeparam name="TService">The type of the requested service</typeparam>
+  /// <typeparam name="Key">The key the service has been registered
+  /// with</typeparam>
+  /// <returns>A pointer to the service, or a nullptr if the service is not
+  /// available</returns>
+  template <typename TService, detail::KeyLiteral Key>
+  TService* getService() {
+    return static_cast<TService*>(getKeyedServiceById(
+        typeIdOf<TService>(), keyIdOf(detail::getKeyId<Key>())));
+  }
+
+  /// <summary>
+  /// Get a keyed singleton or scoped service and fail if the service is not
+  /// available.
+  /// </summary>
+  /// <typeparam name="TService">The type of the requested service</typeparam>
+  /// <param name="key">The key the service has been registered with</param>
+  /// <returns>A reference to the service</returns>
+  template <typename TService>
+  TService& getRequiredService(const ServiceKey& key) {
+    auto res = getService<TService>(key);
+    if (res != nullptr) return *res;
+    throw std::logic_error(
+        typeid(TService).name() +
+        std::string{" has not been registered as a keyed singleton or scoped "
+                    "service."});
+  }
+
+  /// <summary>
+  /// Create a keyed transient service.
+  /// </summary>
+  /// <typeparam name="TService">The type of the requested service</typeparam>
+  /// <param name="key">The key the service has been registered with</param>
+  /// <returns>A shared_ptr to the service, or a nullptr if the service is not
+  /// available</returns>
+  template <typename TService>
+  std::shared_ptr<TService> getTransientService(const ServiceKey& key) {
+    return std::static_pointer_cast<TService>(getKeyedTransientServiceById(
+        typeIdOf<std::shared_ptr<TService>>(), keyIdOf(key.id())));
+  }
+
+  /// <summary>
+  /// Create a keyed transient service with a key that is known at compile
+  /// time.
+  /// </summary>
+  /// <typeparam name="TService">The type of the requested service</typeparam>
+  /// <typeparam name="Key">The key the service has been registered
+  /// with</typeparam>
+  /// <returns>A shared_ptr to the service, or a nullptr if the service is not
+  /// available</returns>
+  template <typename TService, detail::KeyLiteral Key>
+  std::shared_ptr<TService> getTransientService() {
+    return std::static_pointer_cast<TService>(getKeyedTransientServiceById(
+        typeIdOf<std::shared_ptr<TService>>(),
+        keyIdOf(detail::getKeyId<Key>())));
+  }
+
   /// <summary>
   /// Create a transient service.
   /// <para/>
@@ -89,10 +735,8 @@ class IServiceProvider {
   /// available</returns>
   template <typename TService>
   std::shared_ptr<TService> getTransientService() {
-    auto res = getService(std::type_index(typeid(std::shared_ptr<TService>)));
-    if (res.has_value())
-      return std::any_cast<std::shared_ptr<TService>>(std::move(res));
-    return nullptr;
+    return std::static_pointer_cast<TService>(
+        getTransientServiceById(typeIdOf<std::shared_ptr<TService>>()));
   }
 
   /// <summary>
@@ -112,6 +756,39 @@ class IServiceProvider {
         std::string{" has not been registered as a transient service."});
   }
 
+  /// <summary>
+  /// Create a transient service that is owned by the caller.
+  /// <para/>
+  /// If multiple implementations have been registered for this service, the
+  /// last added service is provided.
+  /// </summary>
+  /// <typeparam name="TService">The type of the requested service</typeparam>
+  /// <returns>A unique_ptr to the service, or a nullptr if the service is not
+  /// available</returns>
+  template <typename TService>
+  std::unique_ptr<TService> getUniqueService() {
+    return std::unique_ptr<TService>(static_cast<TService*>(
+        createUniqueServiceById(typeIdOf<std::unique_ptr<TService>>())));
+  }
+
+  /// <summary>
+  /// Create a transient service that is owned by the caller and fail if the
+  /// service is not available.
+  /// <para/>
+  /// If multiple implementations have been registered for this service, the
+  /// last added service is provided.
+  /// </summary>
+  /// <typeparam name="TService">The type of the requested service</typeparam>
+  /// <returns>A unique_ptr to the service, guaranteed to not be null.</returns>
+  template <typename TService>
+  std::unique_ptr<TService> getRequiredUniqueService() {
+    auto res = getUniqueService<TService>();
+    if (res != nullptr) return res;
+    throw std::logic_error(
+        typeid(TService).name() +
+        std::string{" has not been registered as a unique transient service."});
+  }
+
   /// <summary>
   /// Get singleton and scoped services of the requested type.
   /// </summary>
@@ -119,12 +796,20 @@ class IServiceProvider {
   /// <returns>a vector of reference_wrappers to the services.</returns>
   template <typename TService>
   ServiceVector<TService> getServices() {
-    ServiceVector<TService> res;
-    auto servicesAny = getServices(std::type_index(typeid(TService)));
-    for (auto& service : servicesAny)
-      res.emplace_back(
-          std::any_cast<std::reference_wrapper<TService>>(service));
-    return res;
+    auto services = getServiceSpan<TService>();
+    return ServiceVector<TService>(services.begin(), services.end());
+  }
+
+  /// <summary>
+  /// Get singleton and scoped services of the requested type as a cached
+  /// view, which does not allocate after the first call for a type.
+  /// </summary>
+  /// <typeparam name="TService">The type of the services</typeparam>
+  /// <returns>A view of the services, valid as long as this service provider
+  /// exists.</returns>
+  template <typename TService>
+  ServiceSpan<TService> getServiceSpan() {
+    return ServiceSpan<TService>(getServiceSpanById(typeIdOf<TService>()));
   }
 
   /// <summary>
@@ -135,15 +820,34 @@ class IServiceProvider {
   template <typename TService>
   std::vector<std::shared_ptr<TService>> getTransientServices() {
     std::vector<std::shared_ptr<TService>> res;
-    auto servicesAny =
-        getServices(std::type_index(typeid(std::shared_ptr<TService>)));
-    for (auto&& service : std::move(servicesAny))
-      res.emplace_back(
-          std::any_cast<std::shared_ptr<TService>&&>(std::move(service)));
+    auto services =
+        getTransientServicesById(typeIdOf<std::shared_ptr<TService>>());
+    res.reserve(services.size());
+    for (auto& service : services)
+      res.emplace_back(std::static_pointer_cast<TService>(std::move(service)));
     return res;
   }
 };
 
+class ServiceCollection;
+
+/// <summary>
+/// How a service scope may be accessed - see IServiceProviderRoot::createScope
+/// </summary>
+enum class ScopeMode {
+  /// <summary>
+  /// The scope can be used by multiple threads
+  /// </summary>
+  Concurrent,
+  /// <summary>
+  /// The scope is only used by the thread that created it, so scoped services
+  /// are resolved without synchronization. Singletons are still resolved by
+  /// the thread-safe root service provider. Debug builds assert the thread
+  /// affinity.
+  /// </summary>
+  SingleThreaded,
+};
+
 /// <summary>
 /// The root service provider that can create service scopes.
 /// </summary>
@@ -154,5 +858,203 @@ class IServiceProviderRoot : public IServiceProvider {
   /// </summary>
   /// <returns>The scoped service provider</returns>
   virtual std::unique_ptr<IServiceProvider> createScope() = 0;
+
+  /// <summary>
+  /// Create a service scope
+  /// </summary>
+  /// <param name="mode">How the scope may be accessed</param>
+  /// <returns>The scoped service provider</returns>
+  virtual std::unique_ptr<IServiceProvider> createScope(ScopeMode mode) = 0;
+
+  /// <summary>
+  /// Create all singleton services that have not been created yet.
+  /// <para/>
+  /// Singletons that do not depend on each other are created concurrently.
+  /// Services are still destroyed in the reverse order of their creation.
+  /// If a constructor throws, the exception is rethrown after all running
+  /// constructors have finished.
+  /// </summary>
+  /// <param name="numberOfThreads">The number of threads that create
+  /// singletons, including the calling thread</param>
+  virtual void warmUp(size_t numberOfThreads) = 0;
+
+  /// <summary>
+  /// Create a service provider with the registrations of this one, where the
+  /// service types registered in overrides replace all registrations of
+  /// these types.
+  /// <para/>
+  /// Singletons that are not overridden and do not depend on overridden
+  /// services are shared with this service provider, which must outlive the
+  /// child. Singletons created by factory functions are not shared.
+  /// </summary>
+  /// <param name="overrides">The replaced and additional services</param>
+  /// <returns>The child service provider</returns>
+  virtual std::unique_ptr<IServiceProviderRoot> createChild(
+      const ServiceCollection& overrides) = 0;
+
+  /// <summary>
+  /// Replace the instance of a singleton by the id of its type - see
+  /// replaceSingleton.
+  /// </summary>
+  /// <param name="typeId">The id of the type of the service - see
+  /// detail::serviceTypeId</param>
+  /// <param name="service">The new instance, already adjusted to the service
+  /// type</param>
+  virtual void replaceSingletonById(size_t typeId,
+                                    std::shared_ptr<void> service) = 0;
+
+  /// <summary>
+  /// Replace the instance of a singleton service while the service provider
+  /// is in use, e.g. to rotate configuration.
+  /// <para/>
+  /// Resolving the service afterwards returns the new instance, concurrent
+  /// resolutions return either instance without taking a lock. The replaced
+  /// instance is destroyed once all scopes that existed when it was replaced
+  /// have been destroyed, so it must not be used outside of these scopes
+  /// afterwards. If singletons have been created with it, it is kept until
+  /// the service provider is destroyed.
+  /// <para/>
+  /// Instances resolved through the root service provider outside of the
+  /// creation of its singletons, e.g. by getService, a Resolver of the root,
+  /// an injected IServiceProvider or a child service provider, can be used
+  /// for as long as the service provider lives. Once that happened, every
+  /// instance of the service is kept until the service provider is
+  /// destroyed, so services that are replaced repeatedly should only be
+  /// resolved through scopes.
+  /// <para/>
+  /// The current instance is destroyed with the service provider, at the
+  /// position of the original instance in the reverse creation order.
+  /// </summary>
+  /// <typeparam name="TService">The type of the service, its last
+  /// implementation must be a singleton that is not created
+  /// asynchronously</typeparam>
+  /// <param name="service">The new instance</param>
+  template <class TService>
+  void replaceSingleton(std::shared_ptr<TService> service) {
+    if (service == nullptr)
+      throw std::invalid_argument("The new instance must not be null.");
+    replaceSingletonById(typeIdOf<TService>(), std::move(service));
+  }
+
+#ifdef CPPINJECT_INSTRUMENTATION
+  /// <summary>
+  /// Get the resolution counters of all registered implementations, counted
+  /// for the service provider and all of its scopes.
+  /// <para/>
+  /// Only available if CPPINJECT_INSTRUMENTATION is defined.
+  /// </summary>
+  virtual std::vector<ServiceStatistics> statistics() const = 0;
+#endif
+};
+
+/// <summary>
+/// A constructor argument that resolves a singleton or scoped service on
+/// first access and caches it. The service is resolved by the service
+/// provider or scope that created the service with this argument, through
+/// the dependency that was looked up once when the service provider was
+/// built.
+/// <para/>
+/// Lazy dependencies do not take part in the creation order, so they can
+/// break circular dependencies.
+/// </summary>
+/// <typeparam name="TService">The type of the service</typeparam>
+template <class TService>
+class Lazy {
+ public:
+  using element_type = TService;
+  using ResolveFunction = void* (*)(IServiceProvider& serviceProvider,
+                                    const void* dependency);
+
+ private:
+  IServiceProvider* _serviceProvider;
+  const void* _dependency;
+  ResolveFunction _resolve;
+  mutable std::atomic<TService*> _service{nullptr};
+
+ public:
+  /// <summary>
+  /// Create an unresolved handle - Lazy arguments are created by the service
+  /// provider.
+  /// </summary>
+  Lazy(IServiceProvider& serviceProvider, const void* dependency,
+       ResolveFunction resolve)
+      : _serviceProvider(&serviceProvider),
+        _dependency(dependency),
+        _resolve(resolve) {}
+  Lazy(const Lazy& other)
+      : _serviceProvider(other._serviceProvider),
+        _dependency(other._dependency),
+        _resolve(other._resolve),
+        _service(other._service.load(std::memory_order_acquire)) {}
+  Lazy& operator=(const Lazy& other) {
+    _serviceProvider = other._serviceProvider;
+    _dependency = other._dependency;
+    _resolve = other._resolve;
+    _service.store(other._service.load(std::memory_order_acquire),
+                   std::memory_order_release);
+    return *this;
+  }
+
+  /// <summary>
+  /// Get the service, resolving it on the first call. Can be called
+  /// concurrently.
+  /// </summary>
+  TService& get() const {
+    TService* service = _service.load(std::memory_order_acquire);
+    if (service == nullptr) {
+      service =
+          static_cast<TService*>(_resolve(*_serviceProvider, _dependency));
+      _service.store(service, std::memory_order_release);
+    }
+    return *service;
+  }
+  TService& operator*() const { return get(); }
+  TService* operator->() const { return &get(); }
+
+  /// <summary>
+  /// Check whether the service has been resolved
+  /// </summary>
+  bool isResolved() const {
+    return _service.load(std::memory_order_acquire) != nullptr;
+  }
+};
+
+/// <summary>
+/// A constructor argument that creates transient services on demand,
+/// through the service provider or scope that created the service with this
+/// argument and the dependency that was looked up once when the service
+/// provider was built.
+/// </summary>
+/// <typeparam name="TService">The type of the transient service</typeparam>
+template <class TService>
+class Factory {
+ public:
+  using element_type = TService;
+  using CreateFunction = std::shared_ptr<void> (*)(
+      IServiceProvider& serviceProvider, const void* dependency);
+
+ private:
+  IServiceProvider* _serviceProvider;
+  const void* _dependency;
+  CreateFunction _create;
+
+ public:
+  /// <summary>
+  /// Create a factory - Factory arguments are created by the service
+  /// provider.
+  /// </summary>
+  Factory(IServiceProvider& serviceProvider, const void* dependency,
+          CreateFunction create)
+      : _serviceProvider(&serviceProvider),
+        _dependency(dependency),
+        _create(create) {}
+
+  /// <summary>
+  /// Create a new instance of the service
+  /// </summary>
+  std::shared_ptr<TService> operator()() const {
+    return std::static_pointer_cast<TService>(
+        _create(*_serviceProvider, _dependency));
+  }
 };
 }  // namespace CppInject
\ No newline at end of file
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace CppInject::detail {
+
+/// <summary>
+/// A lock-free LIFO of the indices [0, capacity), initially holding all of
+/// them.
+/// <para/>
+/// The head stores the top index together with a tag that changes with every
+/// modification, so a concurrent pop and push of the same index cannot corrupt
+/// the list (ABA problem). Each index must be pushed by at most one thread at a
+/// time, usually the one that popped it.
+/// </summary>
+class IndexFreeList {
+  // Links and the low half of the head store the index + 1, 0 marks the end of
+  // the list.
+  std::atomic<uint64_t> _head{0};
+  std::unique_ptr<std::atomic<uint32_t>[]> _next;
+
+  static constexpr uint64_t linkMask = 0xffffffff;
+  static constexpr uint64_t tagIncrement = uint64_t{1} << 32;
+
+ public:
+  static constexpr size_t npos = ~size_t{0};
+  static constexpr size_t maxCapacity = linkMask - 1;
+
+  /// <summary>
+  /// Create a list holding the indices [0, capacity)
+  /// </summary>
+  /// <param name="capacity">The number of indices, at most
+  /// maxCapacity</param>
+  inline explicit IndexFreeList(size_t capacity) {
+    capacity = std::min(capacity, maxCapacity);
+    _next = std::make_unique<std::atomic<uint32_t>[]>(capacity);
+    for (size_t index = capacity; index-- > 0;) push(index);
+  }
+
+  /// <summary>
+  /// Take an index from the list.
+  /// </summary>
+  /// <returns>The index, or npos if the list is empty</returns>
+  inline size_t pop() {
+    uint64_t head = _head.load(std::memory_order_acquire);
+    while (true) {
+      const uint64_t link = head & linkMask;
+      if (link == 0) return npos;
+      const uint64_t next = _next[link - 1].load(std::memory_order_relaxed);
+      const uint64_t newHead = ((head & ~linkMask) + tagIncrement) | next;
+      if (_head.compare_exchange_weak(head, newHead,
+                                      std::memory_order_acquire,
+                                      std::memory_order_acquire))
+        return static_cast<size_t>(link - 1);
+    }
+  }
+
+  /// <summary>
+  /// Return an index to the list.
+  /// </summary>
+  /// <param name="index">An index that is not in the list</param>
+  inline void push(size_t index) {
+    uint64_t head = _head.load(std::memory_order_relaxed);
+    while (true) {
+      _next[index].store(static_cast<uint32_t>(head & linkMask),
+                         std::memory_order_relaxed);
+      const uint64_t newHead =
+          ((head & ~linkMask) + tagIncrement) | (uint64_t{index} + 1);
+      if (_head.compare_exchange_weak(head, newHead,
+                                      std::memory_order_release,
+                                      std::memory_order_relaxed))
+        return;
+    }
+  }
+};
+}  // namespace CppInject::detail
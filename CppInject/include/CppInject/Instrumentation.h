@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <typeindex>
+#include <typeinfo>
+
+namespace CppInject {
+
+/// <summary>
+/// The life-time of a registered service
+/// </summary>
+enum class ServiceType {
+  Singleton,
+  Scoped,
+  Transient,
+};
+
+/// <summary>
+/// A resolution of one implementation, reported to an IResolutionObserver.
+/// </summary>
+struct ResolutionEvent {
+  /// <summary>
+  /// The type the service is registered under: TService for singleton and
+  /// scoped services, std::shared_ptr&lt;TService&gt; for transient services
+  /// </summary>
+  std::type_index service;
+  const std::type_info* implementation;
+  ServiceType lifetime;
+  /// <summary>
+  /// The index of the implementation in the registrations of the service
+  /// </summary>
+  size_t index;
+  std::thread::id thread;
+  /// <summary>
+  /// The time spent creating the implementation, including the creation of
+  /// dependencies that did not exist yet. 0 for cache hits.
+  /// </summary>
+  std::chrono::nanoseconds duration;
+  /// <summary>
+  /// True if an existing singleton or scoped instance was returned
+  /// </summary>
+  bool cacheHit;
+};
+
+/// <summary>
+/// Receives the resolutions of a service provider and its scopes, see
+/// ServiceProviderOptions::resolutionObserver. onResolution is called
+/// concurrently by all threads that resolve services and must not throw.
+/// <para/>
+/// Only available if CPPINJECT_INSTRUMENTATION is defined.
+/// </summary>
+class IResolutionObserver {
+ public:
+  virtual ~IResolutionObserver() = default;
+  virtual void onResolution(const ResolutionEvent& event) = 0;
+};
+
+/// <summary>
+/// The resolution counters of one implementation, see
+/// IServiceProviderRoot::statistics.
+/// </summary>
+struct ServiceStatistics {
+  std::type_index service;
+  const std::type_info* implementation;
+  ServiceType lifetime;
+  size_t index;
+  /// <summary>
+  /// The number of resolutions, including cache hits
+  /// </summary>
+  uint64_t resolutions;
+  /// <summary>
+  /// The number of instances that have been created
+  /// </summary>
+  uint64_t creations;
+  /// <summary>
+  /// The total time spent creating instances
+  /// </summary>
+  std::chrono::nanoseconds creationTime;
+};
+
+namespace detail {
+
+/// <summary>
+/// The counters behind ServiceStatistics, one per implementation.
+/// </summary>
+struct ResolutionCounters {
+  std::atomic<uint64_t> resolutions{0};
+  std::atomic<uint64_t> creations{0};
+  std::atomic<int64_t> creationNanoseconds{0};
+
+  inline void record(std::chrono::nanoseconds creationTime, bool cacheHit) {
+    resolutions.fetch_add(1, std::memory_order_relaxed);
+    if (cacheHit) return;
+    creations.fetch_add(1, std::memory_order_relaxed);
+    creationNanoseconds.fetch_add(creationTime.count(),
+                                  std::memory_order_relaxed);
+  }
+};
+}  // namespace detail
+}  // namespace CppInject
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+
+#include "IndexFreeList.h"
+#include "TypeTraits.h"
+
+namespace CppInject::detail {
+
+/// <summary>
+/// A lock-free pool of up to capacity reusable objects.
+/// <para/>
+/// acquire hands out an idle object, or constructs one in a free slot. The
+/// returned shared_ptr puts the object back into the pool instead of
+/// destroying it, calling its reset() member function first if it has one.
+/// The deleter keeps the pool alive, so objects may outlive the owner of the
+/// pool.
+/// </summary>
+template <class T>
+class ObjectPool {
+  struct Slot {
+    alignas(T) unsigned char storage[sizeof(T)];
+    bool constructed = false;
+
+    inline T* object() { return std::launder(reinterpret_cast<T*>(storage)); }
+  };
+
+  std::unique_ptr<Slot[]> _slots;
+  const size_t _capacity;
+  // The slots that are not in use, with or without an idle object
+  IndexFreeList _free;
+
+  struct Recycler {
+    std::shared_ptr<ObjectPool> pool;
+    size_t index;
+
+    inline void operator()(T*) const noexcept { pool->release(index); }
+  };
+
+  inline void release(size_t index) noexcept {
+    Slot& slot = _slots[index];
+    if constexpr (TypeTraits::HasReset<T>::value) {
+      try {
+        slot.object()->reset();
+      } catch (...) {
+        // an object that cannot be reset is not reused
+        slot.object()->~T();
+        slot.constructed = false;
+      }
+    }
+    _free.push(index);
+  }
+
+ public:
+  /// <summary>
+  /// Create an empty pool
+  /// </summary>
+  /// <param name="capacity">The maximum number of pooled objects</param>
+  inline explicit ObjectPool(size_t capacity)
+      : _slots(std::make_unique<Slot[]>(capacity)),
+        _capacity(capacity),
+        _free(capacity) {}
+
+  ObjectPool(const ObjectPool&) = delete;
+  ObjectPool& operator=(const ObjectPool&) = delete;
+
+  // All objects are idle, acquired objects keep the pool alive
+  inline ~ObjectPool() {
+    for (size_t i = 0; i < _capacity; ++i)
+      if (_slots[i].constructed) _slots[i].object()->~T();
+  }
+
+  /// <summary>
+  /// Take an object from the pool.
+  /// </summary>
+  /// <param name="pool">The pool</param>
+  /// <param name="construct">(void* storage) -&gt; T*, constructs a new
+  /// object in the storage if the slot does not hold an idle one</param>
+  /// <returns>The object, or a nullptr if all objects are in use</returns>
+  template <class F>
+  inline static std::shared_ptr<T> acquire(
+      const std::shared_ptr<ObjectPool>& pool, F&& construct) {
+    const size_t index = pool->_free.pop();
+    if (index == IndexFreeList::npos) return nullptr;
+    Slot& slot = pool->_slots[index];
+    if (!slot.constructed) {
+      try {
+        construct(static_cast<void*>(slot.storage));
+      } catch (...) {
+        pool->_free.push(index);
+        throw;
+      }
+      slot.constructed = true;
+    }
+    return std::shared_ptr<T>(slot.object(), Recycler{pool, index});
+  }
+};
+}  // namespace CppInject::detail
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+
+namespace CppInject::detail {
+
+/// <summary>
+/// A pointer that is initialized exactly once, even if multiple threads race
+/// to initialize it.
+/// <para/>
+/// The cell is a single pointer-sized word: the state of an uninitialized
+/// cell is stored as a value that is never a valid pointer. Reading an
+/// initialized cell is a single acquire load. Threads that find the cell being
+/// initialized by another thread wait on the word. An uninitialized cell is
+/// zero-initialized and holds no heap memory.
+/// </summary>
+class OnceCell {
+  enum State : uintptr_t {
+    Empty,
+    Initializing,
+    InitializingWithWaiters,
+    // initialized with a nullptr
+    Null,
+  };
+
+  std::atomic<uintptr_t> _word{Empty};
+
+  inline static uintptr_t encode(void* value) {
+    return value != nullptr ? reinterpret_cast<uintptr_t>(value) : Null;
+  }
+
+  inline static void* decode(uintptr_t word) {
+    return word != Null ? reinterpret_cast<void*>(word) : nullptr;
+  }
+
+  template <class F>
+  inline void* initialize(F& init);
+
+ public:
+  /// <summary>
+  /// Get the value of the cell, initialize it if it is empty.
+  /// <para/>
+  /// If init throws, the cell is reset to empty and one of the waiting threads
+  /// retries the initialization.
+  /// </summary>
+  /// <param name="init">Creates the value: () -&gt; void*</param>
+  template <class F>
+  inline void* getOrInit(F&& init) {
+    const uintptr_t word = _word.load(std::memory_order_acquire);
+    if (word > Null) return reinterpret_cast<void*>(word);
+    return initialize(init);
+  }
+
+  /// <summary>
+  /// Get the value of the cell, initialize it if it is empty. For cells that
+  /// are only accessed by one thread: skips the atomic read-modify-write
+  /// operations of getOrInit.
+  /// <para/>
+  /// If init throws, the cell is reset to empty. Throws a std::logic_error if
+  /// init requests the value of the cell it is initializing.
+  /// </summary>
+  /// <param name="init">Creates the value: () -&gt; void*</param>
+  template <class F>
+  inline void* getOrInitUnsynchronized(F&& init) {
+    const uintptr_t word = _word.load(std::memory_order_relaxed);
+    if (word >= Null) return decode(word);
+    if (word != Empty)
+      throw std::logic_error("The service has a circular dependency.");
+    _word.store(Initializing, std::memory_order_relaxed);
+    void* value;
+    try {
+      value = init();
+    } catch (...) {
+      _word.store(Empty, std::memory_order_relaxed);
+      throw;
+    }
+    _word.store(encode(value), std::memory_order_relaxed);
+    return value;
+  }
+
+  /// <summary>
+  /// Get the value of the cell, or a nullptr if it has not been initialized
+  /// yet.
+  /// </summary>
+  inline void* tryGet() const {
+    const uintptr_t word = _word.load(std::memory_order_acquire);
+    return word > Null ? reinterpret_cast<void*>(word) : nullptr;
+  }
+
+  /// <summary>
+  /// Check whether the cell is neither initialized nor being initialized
+  /// </summary>
+  inline bool empty() const {
+    return _word.load(std::memory_order_acquire) == Empty;
+  }
+
+  /// <summary>
+  /// Replace the value of an initialized cell. Readers see either the
+  /// previous or the new value.
+  /// </summary>
+  /// <returns>The previous value</returns>
+  inline void* exchange(void* value) {
+    return decode(_word.exchange(encode(value), std::memory_order_acq_rel));
+  }
+
+  /// <summary>
+  /// Reset the cell to empty. Must not be called concurrently with any other
+  /// member function.
+  /// </summary>
+  inline void reset() { _word.store(Empty, std::memory_order_relaxed); }
+};
+
+template <class F>
+inline void* OnceCell::initialize(F& init) {
+  uintptr_t word = _word.load(std::memory_order_acquire);
+  while (true) {
+    if (word >= Null) return decode(word);
+    if (word == Empty) {
+      if (!_word.compare_exchange_weak(word, Initializing,
+                                       std::memory_order_acquire))
+        continue;
+      void* value;
+      try {
+        value = init();
+      } catch (...) {
+        if (_word.exchange(Empty, std::memory_order_release) ==
+            InitializingWithWaiters)
+          _word.notify_all();
+        throw;
+      }
+      if (_word.exchange(encode(value), std::memory_order_acq_rel) ==
+          InitializingWithWaiters)
+        _word.notify_all();
+      return value;
+    }
+    if (word == Initializing &&
+        !_word.compare_exchange_weak(word, InitializingWithWaiters,
+                                     std::memory_order_acquire))
+      continue;
+    _word.wait(InitializingWithWaiters, std::memory_order_acquire);
+    word = _word.load(std::memory_order_acquire);
+  }
+}
+
+static_assert(sizeof(OnceCell) == sizeof(void*));
+}  // namespace CppInject::detail
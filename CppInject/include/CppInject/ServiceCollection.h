@@ -1,27 +1,100 @@
 #pragma once
 
+#include <algorithm>
 #include <any>
 #include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
 #include <functional>
 #include <future>
 #include <memory>
 #include <mutex>
+#include <new>
+#include <optional>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <tuple>
 #include <type_traits>
 #include <typeindex>
 #include <typeinfo>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "AppendLog.h"
+#include "Arena.h"
 #include "ConstructorFinder.h"
 #include "IServiceProvider.h"
+#include "IndexFreeList.h"
+#include "ObjectPool.h"
+#include "OnceCell.h"
+#include "ThreadLocalServiceCache.h"
 #include "TypeTraits.h"
 
 namespace CppInject {
 
+/// <summary>
+/// Options for the service provider created by ServiceCollection::build.
+/// </summary>
+struct ServiceProviderOptions {
+  /// <summary>
+  /// The number of service scopes that are kept for reuse. createScope hands
+  /// out pooled scopes first and allocates additional scopes only when all of
+  /// them are in use.
+  /// </summary>
+  size_t scopePoolCapacity = 64;
+
+  /// <summary>
+  /// If not 0, scoped services and the transient services created by a scope
+  /// are allocated from an arena owned by the scope, starting with a block of
+  /// this size in bytes. The memory is reclaimed when the scope is destroyed.
+  /// <para/>
+  /// With an arena, transient services created by a scope must not outlive
+  /// the scope.
+  /// </summary>
+  size_t scopeArenaSize = 0;
+
+  /// <summary>
+  /// If not 0, build creates all singleton services with this number of
+  /// threads before it returns - see IServiceProviderRoot::warmUp.
+  /// </summary>
+  size_t warmUpThreads = 0;
+
+  /// <summary>
+  /// If true, each thread caches the singleton services it has resolved by
+  /// type from the service provider or its scopes, so resolving them again
+  /// on the same thread is a thread-local lookup. The cache holds the
+  /// services of the service provider each thread used last.
+  /// </summary>
+  bool threadLocalSingletonCache = false;
+
+  /// <summary>
+  /// If true, build checks the constructor arguments of all services that are
+  /// registered by type and throws a std::logic_error describing every
+  /// problem it finds: dependencies that have not been registered with a
+  /// matching life-time, circular dependencies and scoped services that
+  /// would be captured by singletons.
+  /// <para/>
+  /// Services created by factory functions are not validated.
+  /// </summary>
+  bool validateOnBuild = false;
+
+#ifdef CPPINJECT_INSTRUMENTATION
+  /// <summary>
+  /// If not null, every resolution of a registered implementation by the
+  /// service provider or its scopes is reported to this observer.
+  /// <para/>
+  /// Only available if CPPINJECT_INSTRUMENTATION is defined.
+  /// </summary>
+  std::shared_ptr<IResolutionObserver> resolutionObserver;
+#endif
+};
+
 /// <summary>
 /// A builder for a service provider. This class is used to collect descriptions
 /// for the creation and life time of services. The create function builds a
@@ -40,6 +113,20 @@ class ServiceCollection {
                 std::is_base_of_v<TService, TImplementation>>>
   inline void addSingleton();
 
+  /// <summary>
+  /// Register a keyed singleton service. The keyed accessors of
+  /// IServiceProvider return the last implementation registered with the key,
+  /// the implementation is also one of the implementations of TService.
+  /// </summary>
+  /// <typeparam name="TService">The type of the service</typeparam>
+  /// <typeparam name="TImplementation">The type of the implementation -
+  /// TService must be a base of TImplementation</typeparam>
+  /// <param name="key">The key of the implementation</param>
+  template <class TService, class TImplementation = TService,
+            typename = typename std::enable_if_t<
+                std::is_base_of_v<TService, TImplementation>>>
+  inline void addSingleton(const ServiceKey& key);
+
   /// <summary>
   /// Register a singleton service using a factory
   /// </summary>
@@ -120,6 +207,26 @@ class ServiceCollection {
                 std::is_base_of_v<TService, TImplementation>>>
   inline void addSingleton(std::shared_ptr<TImplementation> existingService);
 
+  /// <summary>
+  /// Register a singleton service that is created asynchronously.
+  /// <para/>
+  /// The factory is called when the service is resolved for the first time
+  /// and must return without waiting for the creation. getServiceAsync
+  /// returns without waiting for the future, getService waits for it. The
+  /// service provider waits for running factories when it is destroyed.
+  /// </summary>
+  /// <typeparam name="TService">The type of the service</typeparam>
+  /// <typeparam name="F">
+  /// Type of the factory function:
+  /// (IServiceProvider&amp;) -&gt;
+  /// std::future&lt;std::unique_ptr&lt;TImplementation&gt;&gt;. A
+  /// shared_future or a future of a shared_ptr can be returned as well.
+  /// </typeparam>
+  /// <param name="factory">The factory function that starts the creation of
+  /// the service instance</param>
+  template <typename TService, typename F>
+  inline void addAsyncSingleton(F&& factory);
+
   /// <summary>
   /// Register a scoped service
   /// </summary>
@@ -131,6 +238,20 @@ class ServiceCollection {
                 std::is_base_of_v<TService, TImplementation>>>
   inline void addScoped();
 
+  /// <summary>
+  /// Register a keyed scoped service. The keyed accessors of
+  /// IServiceProvider return the last implementation registered with the key,
+  /// the implementation is also one of the implementations of TService.
+  /// </summary>
+  /// <typeparam name="TService">The type of the service</typeparam>
+  /// <typeparam name="TImplementation">The type of the implementation -
+  /// TService must be a base of TImplementation</typeparam>
+  /// <param name="key">The key of the implementation</param>
+  template <class TService, class TImplementation = TService,
+            typename = typename std::enable_if_t<
+                std::is_base_of_v<TService, TImplementation>>>
+  inline void addScoped(const ServiceKey& key);
+
   /// <summary>
   /// Register a scoped service using a factory
   /// </summary>
@@ -207,6 +328,20 @@ class ServiceCollection {
                 std::is_base_of_v<TService, TImplementation>>>
   inline void addTransient();
 
+  /// <summary>
+  /// Register a keyed transient service. The keyed accessors of
+  /// IServiceProvider return the last implementation registered with the key,
+  /// the implementation is also one of the implementations of TService.
+  /// </summary>
+  /// <typeparam name="TService">The type of the service</typeparam>
+  /// <typeparam name="TImplementation">The type of the implementation -
+  /// TService must be a base of TImplementation</typeparam>
+  /// <param name="key">The key of the implementation</param>
+  template <class TService, class TImplementation = TService,
+            typename = typename std::enable_if_t<
+                std::is_base_of_v<TService, TImplementation>>>
+  inline void addTransient(const ServiceKey& key);
+
   /// <summary>
   /// Register a transient service using a factory
   /// </summary>
@@ -223,90 +358,772 @@ class ServiceCollection {
                               F, IServiceProvider&>::element_type>>>
   inline void addTransient(F&& factory);
 
+  /// <summary>
+  /// Register a transient service whose instances are reused.
+  /// <para/>
+  /// Every service provider keeps a pool of up to capacity instances.
+  /// Releasing the last shared_ptr to an instance puts it back into the pool,
+  /// calling its reset() member function first if it has one. The pool only
+  /// constructs new instances when all pooled ones are in use and creates
+  /// unpooled instances beyond its capacity.
+  /// <para/>
+  /// A reused instance keeps the dependencies it was constructed with, so
+  /// pooled instances are constructed by the root service provider, even if
+  /// a scope requests them: transient dependencies are not allocated in the
+  /// arena of the scope and IServiceProvider, Lazy and Factory arguments
+  /// refer to the root. The implementation must not depend on scoped
+  /// services.
+  /// </summary>
+  /// <typeparam name="TService">The type of the service</typeparam>
+  /// <typeparam name="TImplementation">The type of the implementation -
+  /// TService must be a base of TImplementation</typeparam>
+  /// <param name="capacity">The maximum number of pooled instances</param>
+  template <class TService, class TImplementation = TService,
+            typename = typename std::enable_if_t<
+                std::is_base_of_v<TService, TImplementation>>>
+  inline void addPooledTransient(size_t capacity);
+
+  /// <summary>
+  /// Register a transient service that is owned by a single consumer. The
+  /// service is injected as std::unique_ptr&lt;TService&gt; and created with
+  /// IServiceProvider::getUniqueService.
+  /// </summary>
+  /// <typeparam name="TService">The type of the service, which needs a
+  /// virtual destructor if it is not the implementation</typeparam>
+  /// <typeparam name="TImplementation">The type of the implementation -
+  /// TService must be a base of TImplementation</typeparam>
+  template <class TService, class TImplementation = TService,
+            typename = typename std::enable_if_t<
+                std::is_base_of_v<TService, TImplementation>>>
+  inline void addUniqueTransient();
+
+  /// <summary>
+  /// Create a service provider from the service collection
+  /// <para/>
+  /// All service providers built from the same state of the collection share
+  /// one immutable copy of the registrations.
+  /// </summary>
+  /// <returns>A unique_ptr to the service provider instance</returns>
+  std::unique_ptr<IServiceProviderRoot> build() &;
+
   /// <summary>
   /// Create a service provider from the service collection
+  /// <para/>
+  /// All service providers built from the same state of the collection share
+  /// one immutable copy of the registrations.
+  /// </summary>
+  /// <param name="options">Options for the service provider</param>
+  /// <returns>A unique_ptr to the service provider instance</returns>
+  std::unique_ptr<IServiceProviderRoot> build(
+      const ServiceProviderOptions& options) &;
+
+  /// <summary>
+  /// Create a service provider from the service collection, moving the
+  /// registrations into the service provider
+  /// </summary>
+  /// <returns>A unique_ptr to the service provider instance</returns>
+  std::unique_ptr<IServiceProviderRoot> build() &&;
+
+  /// <summary>
+  /// Create a service provider from the service collection, moving the
+  /// registrations into the service provider
   /// </summary>
+  /// <param name="options">Options for the service provider</param>
   /// <returns>A unique_ptr to the service provider instance</returns>
-  std::unique_ptr<IServiceProviderRoot> build();
+  std::unique_ptr<IServiceProviderRoot> build(
+      const ServiceProviderOptions& options) &&;
 
  private:
-  enum class ServiceType {
-    Singleton,
-    Scoped,
-    Transient,
-  };
+  using ServiceType = CppInject::ServiceType;
+  struct CreationContext;
+  struct CreatedInstance;
   struct ServiceDescription {
-    using FactoryFunction = std::function<std::any(IServiceProvider& sp)>;
-    using ConversionFunction = std::function<std::any(std::any managedData)>;
+    // Creates a transient instance of the implementation, allocated from the
+    // arena of the context if it is not null.
+    using FactoryFunction =
+        std::function<std::shared_ptr<void>(const CreationContext& context)>;
+    // Destroys a singleton or scoped instance through its owner.
+    using DestroyFunction = void (*)(void* owner);
+    // A singleton or scoped instance, owned by the service provider until it
+    // calls destroy(owner). destroy is nullptr if the instance is owned
+    // elsewhere.
+    struct OwnedInstance {
+      void* implementation;
+      void* owner;
+      DestroyFunction destroy;
+    };
+    // Creates a singleton or scoped instance of the implementation, allocated
+    // from the arena of the context if it is not null.
+    using InstanceFunction =
+        std::function<OwnedInstance(const CreationContext& context)>;
+    // Adjusts a pointer to the implementation to a pointer to the service.
+    using ConversionFunction = void* (*)(void* implementation);
+    // Wraps a pointer to the service for the type-erased getService
+    // functions: a reference_wrapper for singleton and scoped services, a
+    // shared_ptr for transient services.
+    using BoxingFunction = std::any (*)(std::shared_ptr<void> service);
+    // A constructor argument: the type id it is registered under, 0 for
+    // arguments that are always resolved through the service provider.
+    // Deferred arguments (Lazy, Factory) are resolved after construction and
+    // do not order the creation of services.
+    struct DependencyKey {
+      size_t typeId;
+      bool isTransient;
+      const std::type_info* type;
+      bool isDeferred = false;
+    };
+    // Lists the constructor arguments of the implementation.
+    using DependencyFunction = std::vector<DependencyKey> (*)();
+    // Creates the per-provider object pool of a pooled transient service.
+    using PoolFunction = std::shared_ptr<void> (*)(size_t capacity);
+    // Creates an instance of the implementation that is owned by the caller
+    // and returns a pointer to the service.
+    using UniqueFactoryFunction = void* (*)(const CreationContext& context);
+    // nullptr for singleton and scoped services
     FactoryFunction create;
+    // nullptr for transient services
+    InstanceFunction createOwned;
     ConversionFunction convert;
+    BoxingFunction box;
     ServiceType type;
+    const std::type_info* implementation;
+    // nullptr for factory functions, which resolve their own dependencies
+    DependencyFunction dependencies;
+    // nullptr for services that are not pooled
+    PoolFunction createPool = nullptr;
+    size_t poolCapacity = 0;
+    // nullptr for services that are not registered by addUniqueTransient
+    UniqueFactoryFunction createUnique = nullptr;
+    // Starts the factory of an asynchronous singleton. The instance logs
+    // itself in the creation order once it has been created.
+    using AsyncFunction = std::function<detail::AsyncInstance*(
+        const CreationContext& context,
+        detail::AppendLog<CreatedInstance>& initializationOrder)>;
+    // nullptr for services that are not registered by addAsyncSingleton
+    AsyncFunction createAsync;
+    // The id of the ServiceKey, 0 for services without a key
+    size_t keyId = 0;
 
     ServiceDescription(FactoryFunction&& createFunc,
-                       ConversionFunction&& conversionFunc, ServiceType type)
+                       ConversionFunction conversionFunc,
+                       BoxingFunction boxingFunc, ServiceType type,
+                       const std::type_info& implementation,
+                       DependencyFunction dependencyFunc = nullptr)
         : create(std::move(createFunc)),
-          convert(std::move(conversionFunc)),
-          type(type) {}
+          convert(conversionFunc),
+          box(boxingFunc),
+          type(type),
+          implementation(&implementation),
+          dependencies(dependencyFunc) {}
+
+    ServiceDescription(InstanceFunction&& createFunc,
+                       ConversionFunction conversionFunc,
+                       BoxingFunction boxingFunc, ServiceType type,
+                       const std::type_info& implementation,
+                       DependencyFunction dependencyFunc = nullptr)
+        : createOwned(std::move(createFunc)),
+          convert(conversionFunc),
+          box(boxingFunc),
+          type(type),
+          implementation(&implementation),
+          dependencies(dependencyFunc) {}
   };
   using FactoryFunctionCollection = std::vector<ServiceDescription>;
-  std::unordered_map<std::type_index, FactoryFunctionCollection> _factories;
+  struct ServiceRegistration {
+    size_t typeId;
+    // The domain of typeId and of the ids in the descriptions
+    const detail::IdDomain* idDomain;
+    FactoryFunctionCollection descriptions;
+  };
+  using ServiceRegistrations =
+      std::unordered_map<std::type_index, ServiceRegistration>;
+  ServiceRegistrations _factories;
+
+  template <class TKey>
+  inline FactoryFunctionCollection& descriptionsOf();
+
+  template <class TService, class TImplementation>
+  inline static void* convertPointer(void* implementation) {
+    return static_cast<TService*>(
+        static_cast<TImplementation*>(implementation));
+  }
+
+  template <class TService>
+  inline static std::any boxReference(std::shared_ptr<void> service) {
+    return std::ref(*static_cast<TService*>(service.get()));
+  }
 
-  struct ConcurrentService {
-    std::atomic<bool> initialized{false};
-    std::promise<std::any> servicePromise;
-    std::shared_future<std::any> serviceFuture{servicePromise.get_future()};
+  template <class TService>
+  inline static std::any boxSharedPointer(std::shared_ptr<void> service) {
+    return std::static_pointer_cast<TService>(std::move(service));
+  }
+
+  /// <summary>
+  /// The registrations of a service provider, frozen by build. Every
+  /// registered implementation owns one instance slot, the slots of a
+  /// service type are contiguous.
+  /// <para/>
+  /// Each slot also has a resolution plan: the constructor arguments of the
+  /// implementation, looked up once by build, so creating an instance does
+  /// not need to find its dependencies again.
+  /// </summary>
+  struct ServiceTable {
+    struct Entry {
+      FactoryFunctionCollection descriptions;
+      size_t firstSlot;
+      std::type_index type;
+      // The id of type in the domain of the module that built the table
+      size_t typeId;
+      // The domain of the ids in the descriptions, see ServiceRegistration
+      const detail::IdDomain* idDomain;
+      // Maps the id of a ServiceKey to the index of the description + 1, 0 if
+      // the key has not been registered.
+      std::vector<size_t> keyedIndices;
+
+      inline size_t indexOfKey(size_t keyId) const {
+        return keyId < keyedIndices.size() ? keyedIndices[keyId] - 1
+                                           : ~size_t{0};
+      }
+    };
+    // A constructor argument of an implementation. entry is nullptr if the
+    // argument is resolved through the service provider when it is needed.
+    struct Dependency {
+      const Entry* entry;
+      size_t index;
+    };
+    std::vector<Entry> entries;
+    std::unordered_map<std::type_index, size_t> entryIndices;
+    // Maps detail::serviceTypeId to the index of the entry + 1, 0 if the type
+    // has not been registered. The ids are those of the module that built the
+    // table, registrations of other modules are translated by build, see
+    // detail::IdDomain.
+    std::vector<size_t> entryIndicesById;
+    size_t numberOfSlots = 0;
+    // Scopes only hold instances of scoped slots: maps a slot to its index in
+    // the instances of a scope, ~0 for singleton and transient slots.
+    std::vector<size_t> scopedIndexOfSlot;
+    size_t numberOfScopedSlots = 0;
+    // Scopes only hold the service sets of entries with a scoped
+    // implementation: maps an entry to the index of its set in a scope, ~0 if
+    // the set is shared with the root service provider.
+    std::vector<size_t> scopedSetIndexOfEntry;
+    size_t numberOfScopedSets = 0;
+    // The plans of all slots, the plan of a slot is the range
+    // [firstDependency[slot], firstDependency[slot + 1]).
+    std::vector<Dependency> dependencies;
+    std::vector<size_t> firstDependency;
+    // The constructor arguments the plans were made for
+    std::vector<ServiceDescription::DependencyKey> dependencyKeys;
+    std::vector<const Entry*> entryOfSlot;
+    // All slots, each of them after the slots of its planned dependencies
+    std::vector<size_t> topologicalOrder;
+    // The slots of the first circular dependency, empty if there is none
+    std::vector<size_t> cycle;
+    // The last implementation of each entry, which the unkeyed accessors
+    // resolve, see IServiceProvider::getResolver
+    std::vector<Dependency> lastImplementations;
+
+    inline explicit ServiceTable(ServiceRegistrations factories);
+    inline const Entry* find(std::type_index type) const;
+    inline const Entry* find(size_t typeId) const;
+    // nullptr if the last implementation of the type is not a singleton or
+    // scoped service
+    inline const Dependency* lastImplementationOf(size_t typeId) const;
+    inline const Dependency* planOf(size_t slot) const {
+      return dependencies.data() + firstDependency[slot];
+    }
+    inline size_t slotOf(const Dependency& dependency) const {
+      return dependency.entry->firstSlot + dependency.index;
+    }
+    inline void findSingletonDependencies(size_t slot,
+                                          std::vector<size_t>& singletonSlots,
+                                          std::vector<size_t>& visited,
+                                          size_t visitMark) const;
+    inline void findScopedDependencies(size_t slot,
+                                       std::vector<size_t>& scopedSlots,
+                                       std::vector<size_t>& visited,
+                                       size_t visitMark) const;
+    inline void sortTopologically();
+    inline std::string nameOf(size_t slot) const;
+    inline std::string validate() const;
+    // An estimate of the bytes allocated by the table, not counting the
+    // captures of the factory functions
+    inline size_t memoryUsage() const;
+  };
+  // The registrations frozen by the last build, reset by every registration
+  std::shared_ptr<const ServiceTable> _table;
+
+  inline static void validate(const ServiceTable& table) {
+    const std::string problems = table.validate();
+    if (!problems.empty()) throw std::logic_error(problems);
+  }
+
+  // A singleton or scoped instance, in the order of creation. Trivially
+  // copyable, so logging and destroying instances touches no reference counts.
+  struct CreatedInstance {
+    // The slot of the instance. Scopes log their service sets as well, with
+    // numberOfSlots + the index of the set, see ServiceTable::numberOfSlots.
+    size_t slot;
+    void* owner;
+    ServiceDescription::DestroyFunction destroy;
+
+    inline void release() const {
+      if (destroy != nullptr) destroy(owner);
+    }
+  };
+
+  // Takes ownership of the pointer returned by a factory function
+  template <class TPointer>
+  inline static ServiceDescription::OwnedInstance own(TPointer pointer) {
+    using ImplementationType = typename TPointer::element_type;
+    void* implementation = pointer.get();
+    if constexpr (std::is_same_v<TPointer,
+                                 std::unique_ptr<ImplementationType>>) {
+      return {implementation, pointer.release(), [](void* owner) {
+                std::default_delete<ImplementationType>()(
+                    static_cast<ImplementationType*>(owner));
+              }};
+    } else {
+      return {implementation, new TPointer(std::move(pointer)),
+              [](void* owner) { delete static_cast<TPointer*>(owner); }};
+    }
+  }
+
+  // A singleton created by the future of an addAsyncSingleton factory. It is
+  // logged in the creation order when the future is first waited for, after
+  // the services the factory resolved, and destroys the instance with the
+  // future.
+  template <class TService, class TPointer>
+  class AsyncSingleton final : public detail::AsyncInstance {
+    std::shared_future<TPointer> _future;
+    detail::AppendLog<CreatedInstance>& _initializationOrder;
+    const size_t _slot;
+    std::atomic<bool> _logged{false};
+
+    inline static void destroy(void* owner) {
+      delete static_cast<AsyncSingleton*>(owner);
+    }
+
+   public:
+    inline AsyncSingleton(
+        std::shared_future<TPointer> future,
+        detail::AppendLog<CreatedInstance>& initializationOrder, size_t slot)
+        : _future(std::move(future)),
+          _initializationOrder(initializationOrder),
+          _slot(slot) {}
+
+    inline void* get() final {
+      _future.wait();
+      if (!_logged.exchange(true, std::memory_order_acq_rel))
+        _initializationOrder.push(CreatedInstance{_slot, this, &destroy});
+      return static_cast<TService*>(_future.get().get());
+    }
+    inline void wait() const final { _future.wait(); }
+    inline std::future_status waitFor(
+        std::chrono::nanoseconds timeout) const final {
+      return _future.wait_for(timeout);
+    }
   };
 
   class ServiceProvider final : public IServiceProviderRoot {
-    const std::unordered_map<std::type_index, FactoryFunctionCollection>
-        _factories;
-    mutable std::mutex _initializationOrderMutex;
-    std::vector<std::any> _initializationOrder;
-    mutable std::mutex _instancesMutex;
-    std::unordered_map<std::type_index, std::unique_ptr<ConcurrentService[]>>
-        _instances;
+    friend struct CreationContext;
+
+    const std::shared_ptr<const ServiceTable> _table;
+    const ServiceProviderOptions _options;
+    // Every slot is created at most once, so the log cannot overflow
+    detail::AppendLog<CreatedInstance> _initializationOrder;
+    std::unique_ptr<detail::OnceCell[]> _instances;
+    // The non-transient services of each entry, see getServiceSpanById
+    std::unique_ptr<detail::OnceCell[]> _serviceSets;
+    // The object pool of each pooled transient slot, shared by all scopes
+    std::unique_ptr<std::shared_ptr<void>[]> _pools;
+    // A singleton of a child service provider that is created by the parent
+    struct InheritedInstance {
+      const ServiceTable::Entry* entry;
+      size_t index;
+    };
+    ServiceProvider* _parentProvider = nullptr;
+    // nullptr unless this is a child, entry is nullptr for own instances
+    std::unique_ptr<InheritedInstance[]> _inherited;
+    // The AsyncInstance of each asynchronous singleton slot, nullptr if
+    // there are none
+    std::unique_ptr<detail::OnceCell[]> _asyncInstances;
+    // The log index + 1 of the instance of each singleton slot, 0 if the
+    // instance has not been logged by this service provider
+    std::unique_ptr<size_t[]> _logIndexOfSlot;
+
+    // Replaced singletons, see replaceSingletonById. Every replacement starts
+    // a new epoch; scopes record the epoch they were created in while they
+    // are in use, so an instance retired in an epoch is destroyed once no
+    // scope of that epoch or an earlier one is left.
+    struct RetiredInstance {
+      CreatedInstance created;
+      uint64_t epoch;
+    };
+    std::atomic<uint64_t> _epoch{1};
+    std::atomic<size_t> _numberOfRetired{0};
+    std::mutex _replacementMutex;
+    std::vector<RetiredInstance> _retired;
+    // The epochs of all scopes, 0 for scopes that are not in use
+    std::unordered_set<const std::atomic<uint64_t>*> _scopeEpochs;
+    // The instances of replaced slots that live until the service provider is
+    // destroyed, the current instance last
+    std::unordered_map<size_t, std::vector<CreatedInstance>> _replacements;
+    // Instances resolved through the root service provider are not protected
+    // by epochs. Resolving a slot while a singleton of this service provider
+    // is created captures its current instance, which is kept if it is
+    // replaced. Resolving it in any other way, e.g. by getService, pins the
+    // current instance, which is kept until the service provider is
+    // destroyed; later instances are still retired unless they are pinned as
+    // well. A Resolver of the root may resolve any later instance, so it pins
+    // all instances of its slot. Both are set under _replacementMutex.
+    std::unique_ptr<bool[]> _captured;
+    // The pins of each slot: the number of replacements, shifted by
+    // pinVersionShift, and the flags below. A reader that sees the same pins
+    // before and after resolving the slot resolved the pinned instance.
+    std::unique_ptr<std::atomic<uint64_t>[]> _pins;
+    static constexpr uint64_t currentInstancePinned = 1;
+    static constexpr uint64_t allInstancesPinned = 2;
+    static constexpr int pinVersionShift = 2;
+    // The service provider whose instance the current thread is creating
+    inline static thread_local const ServiceProvider* _creatingProvider =
+        nullptr;
+
+    class CreatingInstance {
+      const ServiceProvider* const _previous;
+
+     public:
+      inline explicit CreatingInstance(const ServiceProvider& serviceProvider)
+          : _previous(_creatingProvider) {
+        _creatingProvider = &serviceProvider;
+      }
+      inline ~CreatingInstance() { _creatingProvider = _previous; }
+    };
+
+    inline void inheritSingletons(ServiceProvider& parent,
+                                  const ServiceRegistrations& overrides);
 
     class ScopedServiceProvider final : public IServiceProvider {
       ServiceProvider& _parent;
-      mutable std::mutex _initializationOrderMutex;
-      std::vector<std::any> _initializationOrder;
-      mutable std::mutex _instancesMutex;
-      std::unordered_map<std::type_index, std::unique_ptr<ConcurrentService[]>>
-          _instances;
+      const size_t _poolIndex;
+      // Set by createScope, see ScopeMode::SingleThreaded
+      bool _singleThreaded = false;
+#ifndef NDEBUG
+      std::thread::id _thread;
+#endif
+      detail::AppendLog<CreatedInstance> _initializationOrder;
+      // One cell per scoped slot, see ServiceTable::scopedIndexOfSlot
+      std::unique_ptr<detail::OnceCell[]> _instances;
+      std::unique_ptr<detail::OnceCell[]> _serviceSets;
+      std::optional<detail::Arena> _arena;
+      // The epoch of the root service provider when the scope was created, 0
+      // while the scope is not in use
+      std::atomic<uint64_t> _epoch{0};
+
+      inline void clear();
 
      public:
-      ScopedServiceProvider(ServiceProvider& parent);
+      ScopedServiceProvider(ServiceProvider& parent,
+                            size_t poolIndex = detail::IndexFreeList::npos);
       inline ~ScopedServiceProvider();
+
+      // Pooled scopes are cleared and returned to the pool instead of being
+      // destroyed when the unique_ptr returned by createScope deletes them.
+      inline static void operator delete(ScopedServiceProvider* scope,
+                                         std::destroying_delete_t);
+
       inline std::any getService(std::type_index type) final;
       inline std::vector<std::any> getServices(std::type_index type) final;
+      inline void* getServiceById(size_t typeId) final;
+      inline std::vector<void*> getServicesById(size_t typeId) final;
+      inline std::span<void* const> getServiceSpanById(size_t typeId) final;
+      inline std::shared_ptr<void> getTransientServiceById(
+          size_t typeId) final;
+      inline std::vector<std::shared_ptr<void>> getTransientServicesById(
+          size_t typeId) final;
+      inline void* createUniqueServiceById(size_t typeId) final;
+      inline void* getKeyedServiceById(size_t typeId, size_t keyId) final;
+      inline std::shared_ptr<void> getKeyedTransientServiceById(
+          size_t typeId, size_t keyId) final;
+      inline detail::PendingService getServiceAsyncById(size_t typeId) final;
+      inline void resolveByIds(std::span<const size_t> typeIds,
+                               std::span<void*> services) final;
+      inline size_t memoryUsage() const final;
+      inline detail::ResolverSlot getResolverById(size_t typeId) final;
+      inline size_t getServiceTypeId(std::type_index type) final;
+      inline size_t getKeyId(std::string_view name) final;
+
+      inline void* getInstance(const ServiceTable::Entry& entry, size_t index);
+      inline std::any getService(const ServiceTable::Entry* entry,
+                                 size_t index);
+      inline detail::Arena* arena() {
+        return _arena.has_value() ? &*_arena : nullptr;
+      }
+      inline const ServiceTable& table() const { return *_parent._table; }
+      inline ServiceProvider& root() { return _parent; }
+      inline void* inheritedInstance(size_t) { return nullptr; }
+      inline detail::OnceCell& instanceOf(size_t slot) {
+        return _instances[table().scopedIndexOfSlot[slot]];
+      }
+      inline void setMode(ScopeMode mode) {
+        _singleThreaded = mode == ScopeMode::SingleThreaded;
+#ifndef NDEBUG
+        _thread = std::this_thread::get_id();
+#endif
+      }
+      inline bool singleThreaded() const {
+        assert(!_singleThreaded || _thread == std::this_thread::get_id());
+        return _singleThreaded;
+      }
+      // Keeps the singletons replaced from now on alive until the scope is
+      // cleared, see replaceSingletonById
+      inline void enter() {
+        _epoch.store(_parent._epoch.load(std::memory_order_acquire),
+                     std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+      }
+      inline void recordLogIndex(size_t, size_t) {}
+      inline CreationContext creationContext(size_t slot);
+
+      template <class TServiceProvider>
+      inline static void* getInstance(const ServiceTable::Entry& entry,
+                                      TServiceProvider& serviceProvider,
+                                      size_t index);
+
+      // The non-transient services of an entry, for a service set
+      template <class TServiceProvider>
+      inline static std::vector<void*>* createServiceSet(
+          const ServiceTable::Entry& entry, TServiceProvider& serviceProvider);
+      inline static void deleteServiceSet(void* serviceSet) {
+        delete static_cast<std::vector<void*>*>(serviceSet);
+      }
+
+      inline static void releaseServiceSets(detail::OnceCell* serviceSets,
+                                            size_t numberOfEntries);
+      inline static size_t serviceSetsMemoryUsage(
+          const detail::OnceCell* serviceSets, size_t numberOfEntries);
+
+      template <class TServiceProvider>
+      inline static std::shared_ptr<void> createInstance(
+          const ServiceTable::Entry& entry, TServiceProvider& serviceProvider,
+          size_t index);
 
       template <class TServiceProvider>
-      inline static std::any getService(
-          const std::pair<std::type_index, FactoryFunctionCollection>&
-              factories,
-          TServiceProvider& serviceProviderForThisService,
-          IServiceProvider& serviceProviderForDependentServices, size_t index);
+      inline static void* createUniqueInstance(
+          const ServiceTable::Entry& entry, TServiceProvider& serviceProvider,
+          size_t index);
     };
 
+    const size_t _scopeArenaSize;
+    // Changed by replaceSingletonById, which invalidates the thread-local
+    // caches
+    std::atomic<uint64_t> _id;
+    const bool _threadLocalSingletonCache;
+    std::unique_ptr<std::optional<ScopedServiceProvider>[]> _scopePool;
+    detail::IndexFreeList _freeScopes;
+#ifdef CPPINJECT_INSTRUMENTATION
+    std::unique_ptr<detail::ResolutionCounters[]> _counters;
+    std::shared_ptr<IResolutionObserver> _observer;
+#endif
+
    public:
-    ServiceProvider(
-        std::unordered_map<std::type_index, FactoryFunctionCollection>
-            factories)
-        : _factories(std::move(factories)) {}
+    inline ServiceProvider(std::shared_ptr<const ServiceTable> table,
+                           const ServiceProviderOptions& options);
 
     inline ~ServiceProvider();
 
     inline std::any getService(std::type_index type) final;
     inline std::vector<std::any> getServices(std::type_index type) final;
+    inline void* getServiceById(size_t typeId) final;
+    inline std::vector<void*> getServicesById(size_t typeId) final;
+    inline std::span<void* const> getServiceSpanById(size_t typeId) final;
+    inline std::shared_ptr<void> getTransientServiceById(size_t typeId) final;
+    inline std::vector<std::shared_ptr<void>> getTransientServicesById(
+        size_t typeId) final;
+    inline void* createUniqueServiceById(size_t typeId) final;
+    inline void* getKeyedServiceById(size_t typeId, size_t keyId) final;
+    inline std::shared_ptr<void> getKeyedTransientServiceById(
+        size_t typeId, size_t keyId) final;
+    inline detail::PendingService getServiceAsyncById(size_t typeId) final;
+    inline void resolveByIds(std::span<const size_t> typeIds,
+                             std::span<void*> services) final;
+    inline size_t memoryUsage() const final;
+    inline detail::ResolverSlot getResolverById(size_t typeId) final;
+    inline size_t getServiceTypeId(std::type_index type) final;
+    inline size_t getKeyId(std::string_view name) final;
     inline std::unique_ptr<IServiceProvider> createScope() final;
+    inline std::unique_ptr<IServiceProvider> createScope(ScopeMode mode) final;
+    inline void warmUp(size_t numberOfThreads) final;
+    inline std::unique_ptr<IServiceProviderRoot> createChild(
+        const ServiceCollection& overrides) final;
+    inline void replaceSingletonById(size_t typeId,
+                                     std::shared_ptr<void> service) final;
+#ifdef CPPINJECT_INSTRUMENTATION
+    inline std::vector<ServiceStatistics> statistics() const final;
+    inline void recordResolution(const ServiceTable::Entry& entry,
+                                 size_t index,
+                                 std::chrono::nanoseconds creationTime,
+                                 bool cacheHit);
+#endif
+
+    inline void* getInstance(const ServiceTable::Entry& entry, size_t index);
+    inline detail::AsyncInstance* getAsyncInstance(
+        const ServiceTable::Entry& entry, size_t index);
+    inline std::any getService(const ServiceTable::Entry* entry, size_t index);
+    template <class TServiceProvider>
+    inline void* getServiceById(TServiceProvider& serviceProvider,
+                                size_t typeId);
+    inline detail::Arena* arena() { return nullptr; }
+    inline const ServiceTable& table() const { return *_table; }
+    inline ServiceProvider& root() { return *this; }
+    inline constexpr bool singleThreaded() const { return false; }
+    inline void* inheritedInstance(size_t slot) {
+      if (_inherited == nullptr || _inherited[slot].entry == nullptr)
+        return nullptr;
+      return _parentProvider->getInstance(*_inherited[slot].entry,
+                                          _inherited[slot].index);
+    }
+    inline detail::OnceCell& instanceOf(size_t slot) {
+      return _instances[slot];
+    }
+    inline const std::shared_ptr<void>& poolOf(size_t slot) const {
+      return _pools[slot];
+    }
+    inline void recordLogIndex(size_t slot, size_t logIndex) {
+      _logIndexOfSlot[slot] = logIndex + 1;
+    }
+    // Called before a Resolver of the root is handed out, see _pins
+    inline void pinAllInstances(size_t slot);
+    // The non-transient services of the entry, created once. Scopes share
+    // the sets of entries without scoped implementations.
+    inline std::span<void* const> getServiceSet(
+        const ServiceTable::Entry& entry);
+    // Resolves the slot through the root service provider: captures the
+    // resolved instance while a singleton is created, pins it otherwise
+    template <class F, class G>
+    inline std::invoke_result_t<F> resolveOutsideScopes(size_t slot,
+                                                        F&& resolve,
+                                                        G&& isCurrent);
+    inline CreationContext creationContext(size_t slot);
+    // Destroys the retired instances no scope can use anymore
+    inline void releaseRetired();
+    // Destroys the instances of a replaced slot that live until teardown
+    inline void releaseReplacements(size_t slot);
+  };
+
+  /// <summary>
+  /// The service provider and resolution plan used to create one instance.
+  /// Singletons are always created in the context of the root service
+  /// provider, scoped and transient services in the context of the service
+  /// provider that requested them.
+  /// </summary>
+  struct CreationContext {
+    IServiceProvider& serviceProvider;
+    detail::Arena* arena;
+    // The constructor arguments, only valid for implementations created by a
+    // ServiceFactory
+    const ServiceTable::Dependency* plan;
+    ServiceProvider& root;
+    ServiceProvider::ScopedServiceProvider* scope;
+    size_t slot;
+
+    inline void* getService(const ServiceTable::Dependency& dependency) const;
+    inline std::shared_ptr<void> getTransientService(
+        const ServiceTable::Dependency& dependency) const;
+    inline void* getUniqueService(
+        const ServiceTable::Dependency& dependency) const;
+
+    // The resolve functions of Lazy and Factory arguments
+    inline static void* getServiceInRoot(IServiceProvider& serviceProvider,
+                                         const void* dependency);
+    inline static void* getServiceInScope(IServiceProvider& serviceProvider,
+                                          const void* dependency);
+    inline static std::shared_ptr<void> getTransientServiceInRoot(
+        IServiceProvider& serviceProvider, const void* dependency);
+    inline static std::shared_ptr<void> getTransientServiceInScope(
+        IServiceProvider& serviceProvider, const void* dependency);
   };
 
   template <class TService>
   class ServiceFactory {
+    using Arguments = ConstructorArgsAsTuple<TService>;
+
+    template <class T>
+    inline constexpr static bool isResolvedDynamically =
+        std::is_same_v<IServiceProvider, T> || TypeTraits::IsVector<T>::value ||
+        TypeTraits::IsServiceSpan<T>::value;
+
+    using DependencyKey = ServiceDescription::DependencyKey;
+
+    template <class T>
+    inline static typename std::enable_if_t<isResolvedDynamically<T>,
+                                            DependencyKey>
+    dependencyKey() {
+      return DependencyKey{0, false, &typeid(T)};
+    }
+
+    template <class T>
+    inline static typename std::enable_if_t<
+        TypeTraits::IsSharedPointer<T>::value, DependencyKey>
+    dependencyKey() {
+      return DependencyKey{
+          detail::getServiceTypeId<std::shared_ptr<typename T::element_type>>(),
+          true, &typeid(typename T::element_type)};
+    }
+
+    template <class T>
+    inline static typename std::enable_if_t<
+        TypeTraits::IsUniquePointer<T>::value, DependencyKey>
+    dependencyKey() {
+      return DependencyKey{
+          detail::getServiceTypeId<std::unique_ptr<typename T::element_type>>(),
+          true, &typeid(typename T::element_type)};
+    }
+
+    template <class T>
+    inline static typename std::enable_if_t<TypeTraits::IsLazy<T>::value,
+                                            DependencyKey>
+    dependencyKey() {
+      using Service = typename T::element_type;
+      return DependencyKey{detail::getServiceTypeId<Service>(), false,
+                           &typeid(Service), true};
+    }
+
+    template <class T>
+    inline static typename std::enable_if_t<TypeTraits::IsFactory<T>::value,
+                                            DependencyKey>
+    dependencyKey() {
+      using Service = typename T::element_type;
+      return DependencyKey{
+          detail::getServiceTypeId<std::shared_ptr<Service>>(), true,
+          &typeid(Service), true};
+    }
+
+    template <class T>
+    inline constexpr static bool isReference =
+        !TypeTraits::IsSharedPointer<T>::value &&
+        !TypeTraits::IsUniquePointer<T>::value &&
+        !TypeTraits::IsLazy<T>::value && !TypeTraits::IsFactory<T>::value &&
+        !isResolvedDynamically<T>;
+
+    template <class T>
+    inline static typename std::enable_if_t<isReference<T>, DependencyKey>
+    dependencyKey() {
+      return DependencyKey{detail::getServiceTypeId<T>(), false, &typeid(T)};
+    }
+
+    template <std::size_t... I>
+    inline static std::vector<DependencyKey> dependencyKeys(
+        std::index_sequence<I...>) {
+      return {dependencyKey<
+          std::remove_reference_t<std::tuple_element_t<I, Arguments>>>()...};
+    }
+
     template <class T>
     inline typename std::enable_if_t<std::is_same_v<IServiceProvider, T>, T&>
-    getService(IServiceProvider& serviceProvider) {
-      return serviceProvider;
+    getService(const CreationContext& context,
+               const ServiceTable::Dependency&) {
+      return context.serviceProvider;
     }
 
     template <class T>
@@ -315,12 +1132,17 @@ class ServiceCollection {
                                       TypeTraits::IsSharedPointer<std::decay_t<
                                           typename T::value_type>>::value,
                                   T>
-        getService(IServiceProvider& serviceProvider) {
+        getService(const CreationContext& context,
+                   const ServiceTable::Dependency&) {
+      using Service =
+          typename std::decay_t<typename T::value_type>::element_type;
       T services{};
-      auto servicesAny = serviceProvider.getServices(
-          std::type_index(typeid(std::decay_t<typename T::value_type>)));
-      for (auto&& service : std::move(servicesAny))
-        services.emplace_back(std::any_cast<T::value_type>(std::move(service)));
+      auto instances = context.serviceProvider.getTransientServicesById(
+          detail::getServiceTypeId<std::shared_ptr<Service>>());
+      services.reserve(instances.size());
+      for (auto& instance : instances)
+        services.emplace_back(
+            std::static_pointer_cast<Service>(std::move(instance)));
       return services;
     }
 
@@ -330,54 +1152,168 @@ class ServiceCollection {
                                       !TypeTraits::IsSharedPointer<std::decay_t<
                                           typename T::value_type>>::value,
                                   T>
-        getService(IServiceProvider& serviceProvider) {
-      T services{};
-      auto servicesAny = serviceProvider.getServices(
-          std::type_index(typeid(std::decay_t<typename T::value_type::type>)));
-      for (auto& service : servicesAny)
-        services.emplace_back(
-            std::any_cast<std::reference_wrapper<
-                std::remove_const_t<T::value_type::type>>>(service));
-      return services;
+        getService(const CreationContext& context,
+                   const ServiceTable::Dependency&) {
+      using Service = typename T::value_type::type;
+      auto instances =
+          context.serviceProvider.template getServiceSpan<Service>();
+      return T(instances.begin(), instances.end());
+    }
+
+    template <class T>
+    inline typename std::enable_if_t<TypeTraits::IsServiceSpan<T>::value, T>
+    getService(const CreationContext& context,
+               const ServiceTable::Dependency&) {
+      return context.serviceProvider
+          .template getServiceSpan<typename T::element_type>();
     }
 
     template <class T>
     inline std::enable_if_t<TypeTraits::IsSharedPointer<T>::value, T>
-    getService(IServiceProvider& serviceProvider) {
-      return std::any_cast<T>(
-          serviceProvider.getService(std::type_index(typeid(T))));
+    getService(const CreationContext& context,
+               const ServiceTable::Dependency& dependency) {
+      if (dependency.entry == nullptr)
+        return context.serviceProvider
+            .getRequiredTransientService<typename T::element_type>();
+      return std::static_pointer_cast<typename T::element_type>(
+          context.getTransientService(dependency));
     }
 
     template <class T>
-    inline std::enable_if_t<!TypeTraits::IsSharedPointer<T>::value &&
-                                !TypeTraits::IsVector<T>::value &&
-                                !std::is_same_v<IServiceProvider, T>,
-                            T&>
-    getService(IServiceProvider& serviceProvider) {
-      return std::any_cast<std::reference_wrapper<T>>(
-          serviceProvider.getService(std::type_index(typeid(T))));
+    inline std::enable_if_t<TypeTraits::IsUniquePointer<T>::value, T>
+    getService(const CreationContext& context,
+               const ServiceTable::Dependency& dependency) {
+      if (dependency.entry == nullptr)
+        return context.serviceProvider
+            .getRequiredUniqueService<typename T::element_type>();
+      return T(static_cast<typename T::element_type*>(
+          context.getUniqueService(dependency)));
     }
 
-    template <class Tuple, std::size_t I = 0, class... Args>
-    inline typename std::enable_if_t<I == std::tuple_size_v<Tuple>,
-                                     std::shared_ptr<TService>>
-    createInternal(IServiceProvider& serviceProvider, Args&&... args) {
-      return std::make_shared<TService>(std::forward<Args>(args)...);
+    template <class T>
+    inline std::enable_if_t<TypeTraits::IsLazy<T>::value, T> getService(
+        const CreationContext& context,
+        const ServiceTable::Dependency& dependency) {
+      if (dependency.entry == nullptr)
+        return T(context.serviceProvider, nullptr,
+                 [](IServiceProvider& serviceProvider, const void*) -> void* {
+                   return &serviceProvider
+                               .getRequiredService<typename T::element_type>();
+                 });
+      return T(context.serviceProvider, &dependency,
+               context.scope != nullptr ? &CreationContext::getServiceInScope
+                                        : &CreationContext::getServiceInRoot);
     }
 
-    template <class Tuple, std::size_t I = 0, class... Args>
-    inline typename std::enable_if_t<(I < std::tuple_size_v<Tuple>),
-                                     std::shared_ptr<TService>>
-    createInternal(IServiceProvider& serviceProvider, Args&&... args) {
-      using Type = std::tuple_element_t<I, Tuple>;
-      return createInternal<Tuple, I + 1, Args...>(
-          serviceProvider, std::forward<Args>(args)...,
-          getService<std::remove_reference_t<Type>>(serviceProvider));
+    template <class T>
+    inline std::enable_if_t<TypeTraits::IsFactory<T>::value, T> getService(
+        const CreationContext& context,
+        const ServiceTable::Dependency& dependency) {
+      if (dependency.entry == nullptr)
+        return T(context.serviceProvider, nullptr,
+                 [](IServiceProvider& serviceProvider,
+                    const void*) -> std::shared_ptr<void> {
+                   return serviceProvider.getRequiredTransientService<
+                       typename T::element_type>();
+                 });
+      return T(context.serviceProvider, &dependency,
+               context.scope != nullptr
+                   ? &CreationContext::getTransientServiceInScope
+                   : &CreationContext::getTransientServiceInRoot);
+    }
+
+    template <class T>
+    inline std::enable_if_t<isReference<T>, T&> getService(
+        const CreationContext& context,
+        const ServiceTable::Dependency& dependency) {
+      if (dependency.entry == nullptr)
+        return context.serviceProvider.getRequiredService<T>();
+      return *static_cast<T*>(context.getService(dependency));
+    }
+
+    // Resolves the constructor arguments and passes them to construct
+    template <std::size_t I = 0, class F, class... Args>
+    inline auto createInternal(const CreationContext& context, F& construct,
+                               Args&&... args) {
+      if constexpr (I == std::tuple_size_v<Arguments>) {
+        return construct(std::forward<Args>(args)...);
+      } else {
+        using Type = std::tuple_element_t<I, Arguments>;
+        return createInternal<I + 1>(
+            context, construct, std::forward<Args>(args)...,
+            getService<std::remove_reference_t<Type>>(context,
+                                                      context.plan[I]));
+      }
     }
 
    public:
-    inline std::shared_ptr<TService> create(IServiceProvider& serviceProvider) {
-      return createInternal<ConstructorArgsAsTuple<TService>>(serviceProvider);
+    inline std::shared_ptr<TService> create(const CreationContext& context) {
+      auto construct = [&context](auto&&... args) {
+        if (context.arena != nullptr)
+          return std::allocate_shared<TService>(
+              detail::ArenaAllocator<TService>(*context.arena),
+              std::forward<decltype(args)>(args)...);
+        return std::make_shared<TService>(
+            std::forward<decltype(args)>(args)...);
+      };
+      return createInternal(context, construct);
+    }
+
+    // Creates a singleton or scoped instance that is destroyed without a
+    // control block, see destroy and destroyInArena
+    inline ServiceDescription::OwnedInstance createOwned(
+        const CreationContext& context) {
+      auto construct = [&context](auto&&... args) {
+        if (context.arena != nullptr)
+          return new (context.arena->allocate(sizeof(TService),
+                                              alignof(TService)))
+              TService(std::forward<decltype(args)>(args)...);
+        return new TService(std::forward<decltype(args)>(args)...);
+      };
+      TService* instance = createInternal(context, construct);
+      return {instance, instance,
+              context.arena != nullptr ? &destroyInArena : &destroy};
+    }
+
+    inline static void destroy(void* instance) {
+      std::default_delete<TService>()(static_cast<TService*>(instance));
+    }
+
+    // The arena releases the memory when the scope is cleared
+    inline static void destroyInArena(void* instance) {
+      static_cast<TService*>(instance)->~TService();
+    }
+
+    inline TService* createUnique(const CreationContext& context) {
+      auto construct = [](auto&&... args) {
+        return new TService(std::forward<decltype(args)>(args)...);
+      };
+      return createInternal(context, construct);
+    }
+
+    // Takes an instance from the pool of the requesting service provider, or
+    // creates an unpooled one if the pool is exhausted. Pooled instances
+    // outlive the requesting scope, so they are constructed in the context of
+    // the root service provider.
+    inline std::shared_ptr<TService> createPooled(
+        const CreationContext& context) {
+      auto pool = std::static_pointer_cast<detail::ObjectPool<TService>>(
+          context.root.poolOf(context.slot));
+      auto instance = detail::ObjectPool<TService>::acquire(
+          pool, [&](void* storage) {
+            auto construct = [storage](auto&&... args) {
+              return new (storage)
+                  TService(std::forward<decltype(args)>(args)...);
+            };
+            return createInternal(context.root.creationContext(context.slot),
+                                  construct);
+          });
+      return instance != nullptr ? instance : create(context);
+    }
+
+    inline static std::vector<DependencyKey> dependencies() {
+      return dependencyKeys(
+          std::make_index_sequence<std::tuple_size_v<Arguments>>{});
     }
   };
 
@@ -405,22 +1341,29 @@ class ServiceCollection {
   inline void addExistingService(F&& converter);
 };
 
+template <class TKey>
+inline ServiceCollection::FactoryFunctionCollection&
+ServiceCollection::descriptionsOf() {
+  _table.reset();
+  return _factories
+      .emplace(std::type_index(typeid(TKey)),
+               ServiceRegistration{detail::getServiceTypeId<TKey>(),
+                                   detail::idDomain(), {}})
+      .first->second.descriptions;
+}
+
 template <class TService, class TImplementation,
           ServiceCollection::ServiceType serviceType, typename>
 inline void ServiceCollection::addService() {
-  const auto typeIndex = std::type_index(typeid(TService));
-  auto& serviceFactories =
-      _factories.emplace(typeIndex, FactoryFunctionCollection{}).first->second;
+  auto& serviceFactories = descriptionsOf<TService>();
   serviceFactories.emplace_back(
-      [](IServiceProvider& sp) -> std::any {
+      [](const CreationContext& context) -> ServiceDescription::OwnedInstance {
         ServiceFactory<TImplementation> sf;
-        return sf.create(sp);
+        return sf.createOwned(context);
       },
-      [](std::any managedData) -> std::any {
-        return std::ref(static_cast<TService&>(
-            *std::any_cast<std::shared_ptr<TImplementation>&>(managedData)));
-      },
-      serviceType);
+      &convertPointer<TService, TImplementation>, &boxReference<TService>,
+      serviceType, typeid(TImplementation),
+      &ServiceFactory<TImplementation>::dependencies);
 }
 
 template <class TService, class TImplementation, typename>
@@ -433,23 +1376,31 @@ inline void ServiceCollection::addScoped() {
   addService<TService, TImplementation, ServiceType::Scoped>();
 }
 
+template <class TService, class TImplementation, typename>
+inline void ServiceCollection::addSingleton(const ServiceKey& key) {
+  addService<TService, TImplementation, ServiceType::Singleton>();
+  descriptionsOf<TService>().back().keyId = key.id();
+}
+
+template <class TService, class TImplementation, typename>
+inline void ServiceCollection::addScoped(const ServiceKey& key) {
+  addService<TService, TImplementation, ServiceType::Scoped>();
+  descriptionsOf<TService>().back().keyId = key.id();
+}
+
 template <class TService, ServiceCollection::ServiceType serviceType, class F,
           typename>
 inline void ServiceCollection::addService(F&& factory) {
-  using SharedPtrType = std::shared_ptr<
-      typename std::invoke_result_t<F, IServiceProvider&>::element_type>;
-  const auto typeIndex = std::type_index(typeid(TService));
-  auto& serviceFactories =
-      _factories.emplace(typeIndex, FactoryFunctionCollection{}).first->second;
+  using ImplementationType =
+      typename std::invoke_result_t<F, IServiceProvider&>::element_type;
+  auto& serviceFactories = descriptionsOf<TService>();
   serviceFactories.emplace_back(
-      [f = std::move(factory)](IServiceProvider& sp) -> std::any {
-        return SharedPtrType(f(sp));
+      [f = std::move(factory)](
+          const CreationContext& context) -> ServiceDescription::OwnedInstance {
+        return own(f(context.serviceProvider));
       },
-      [](std::any managedData) -> std::any {
-        return std::ref(static_cast<TService&>(
-            *std::any_cast<SharedPtrType&>(managedData)));
-      },
-      serviceType);
+      &convertPointer<TService, ImplementationType>, &boxReference<TService>,
+      serviceType, typeid(ImplementationType));
 }
 
 template <class TService, class F, typename>
@@ -467,20 +1418,18 @@ inline void ServiceCollection::addSingleton(F&& factory) {
 template <class TService, ServiceCollection::ServiceType serviceType, class F,
           typename>
 inline void ServiceCollection::addExistingService(F&& converter) {
-  using RefWrapperType = std::reference_wrapper<
-      std::decay_t<typename std::invoke_result_t<F, IServiceProvider&>>>;
-  const auto typeIndex = std::type_index(typeid(TService));
-  auto& serviceFactories =
-      _factories.emplace(typeIndex, FactoryFunctionCollection{}).first->second;
+  using ImplementationType =
+      std::decay_t<typename std::invoke_result_t<F, IServiceProvider&>>;
+  auto& serviceFactories = descriptionsOf<TService>();
   serviceFactories.emplace_back(
-      [f = std::move(converter)](IServiceProvider& sp) -> std::any {
-        return RefWrapperType(f(sp));
-      },
-      [](std::any managedData) -> std::any {
-        return std::ref(static_cast<TService&>(
-            std::any_cast<RefWrapperType>(managedData).get()));
+      [f = std::move(converter)](
+          const CreationContext& context) -> ServiceDescription::OwnedInstance {
+        // the instance is owned elsewhere
+        ImplementationType& instance = f(context.serviceProvider);
+        return {std::addressof(instance), nullptr, nullptr};
       },
-      serviceType);
+      &convertPointer<TService, ImplementationType>, &boxReference<TService>,
+      serviceType, typeid(ImplementationType));
 }
 
 template <class TService, class F, typename>
@@ -526,144 +1475,1515 @@ inline void ServiceCollection::addSingleton(
       });
 }
 
+template <class TService, class F>
+inline void ServiceCollection::addAsyncSingleton(F&& factory) {
+  using FutureType = std::invoke_result_t<F, IServiceProvider&>;
+  using PointerType =
+      std::decay_t<decltype(std::declval<FutureType&>().get())>;
+  using ImplementationType = typename PointerType::element_type;
+  static_assert(std::is_base_of_v<TService, ImplementationType>,
+                "The factory must return a future of a pointer to a "
+                "TService.");
+  auto& serviceFactories = descriptionsOf<TService>();
+  serviceFactories.emplace_back(
+      ServiceDescription::InstanceFunction{},
+      &convertPointer<TService, ImplementationType>, &boxReference<TService>,
+      ServiceType::Singleton, typeid(ImplementationType));
+  serviceFactories.back().createAsync =
+      [f = std::move(factory)](
+          const CreationContext& context,
+          detail::AppendLog<CreatedInstance>& initializationOrder)
+      -> detail::AsyncInstance* {
+    return new AsyncSingleton<TService, PointerType>(
+        f(context.serviceProvider), initializationOrder, context.slot);
+  };
+}
+
 template <class TService, class TImplementation, typename>
 inline void ServiceCollection::addTransient() {
-  const auto typeIndex = std::type_index(typeid(std::shared_ptr<TService>));
-  auto& factories =
-      _factories.emplace(typeIndex, FactoryFunctionCollection{}).first->second;
+  auto& factories = descriptionsOf<std::shared_ptr<TService>>();
+  factories.emplace_back(
+      [](const CreationContext& context) -> std::shared_ptr<void> {
+        ServiceFactory<TImplementation> sf;
+        return sf.create(context);
+      },
+      &convertPointer<TService, TImplementation>, &boxSharedPointer<TService>,
+      ServiceType::Transient, typeid(TImplementation),
+      &ServiceFactory<TImplementation>::dependencies);
+}
+
+template <class TService, class TImplementation, typename>
+inline void ServiceCollection::addTransient(const ServiceKey& key) {
+  addTransient<TService, TImplementation>();
+  descriptionsOf<std::shared_ptr<TService>>().back().keyId = key.id();
+}
+
+template <class TService, class TImplementation, typename>
+inline void ServiceCollection::addPooledTransient(size_t capacity) {
+  auto& factories = descriptionsOf<std::shared_ptr<TService>>();
   factories.emplace_back(
-      [](IServiceProvider& sp) -> std::any {
+      [](const CreationContext& context) -> std::shared_ptr<void> {
         ServiceFactory<TImplementation> sf;
-        return sf.create(sp);
+        return sf.createPooled(context);
       },
-      [](std::any managedData) -> std::any {
-        return std::static_pointer_cast<TService>(
-            std::any_cast<std::shared_ptr<TImplementation>>(
-                std::move(managedData)));
+      &convertPointer<TService, TImplementation>, &boxSharedPointer<TService>,
+      ServiceType::Transient, typeid(TImplementation),
+      &ServiceFactory<TImplementation>::dependencies);
+  factories.back().createPool = [](size_t capacity) -> std::shared_ptr<void> {
+    return std::make_shared<detail::ObjectPool<TImplementation>>(capacity);
+  };
+  factories.back().poolCapacity = capacity;
+}
+
+template <class TService, class TImplementation, typename>
+inline void ServiceCollection::addUniqueTransient() {
+  static_assert(std::is_same_v<TService, TImplementation> ||
+                    std::has_virtual_destructor_v<TService>,
+                "TService needs a virtual destructor to be deleted by a "
+                "unique_ptr to TService.");
+  auto& factories = descriptionsOf<std::unique_ptr<TService>>();
+  // the type-erased getService functions box a shared_ptr<TService>
+  factories.emplace_back(
+      [](const CreationContext& context) -> std::shared_ptr<void> {
+        ServiceFactory<TImplementation> sf;
+        return sf.create(context);
       },
-      ServiceType::Transient);
+      &convertPointer<TService, TImplementation>, &boxSharedPointer<TService>,
+      ServiceType::Transient, typeid(TImplementation),
+      &ServiceFactory<TImplementation>::dependencies);
+  factories.back().createUnique = [](const CreationContext& context) -> void* {
+    ServiceFactory<TImplementation> sf;
+    return static_cast<TService*>(sf.createUnique(context));
+  };
 }
 
 template <class TService, class F, typename>
 inline void ServiceCollection::addTransient(F&& factory) {
-  using SharedPtrType = std::shared_ptr<
-      typename std::invoke_result_t<F, IServiceProvider&>::element_type>;
-  const auto typeIndex = std::type_index(typeid(std::shared_ptr<TService>));
-  auto& factories =
-      _factories.emplace(typeIndex, FactoryFunctionCollection{}).first->second;
+  using ImplementationType =
+      typename std::invoke_result_t<F, IServiceProvider&>::element_type;
+  auto& factories = descriptionsOf<std::shared_ptr<TService>>();
   factories.emplace_back(
-      [f = std::move(factory)](IServiceProvider& sp) -> std::any {
-        return SharedPtrType(f(sp));
-      },
-      [](std::any managedData) -> std::any {
-        return std::static_pointer_cast<TService>(
-            std::any_cast<SharedPtrType>(std::move(managedData)));
+      [f = std::move(factory)](
+          const CreationContext& context) -> std::shared_ptr<void> {
+        return std::shared_ptr<ImplementationType>(f(context.serviceProvider));
       },
-      ServiceType::Transient);
+      &convertPointer<TService, ImplementationType>,
+      &boxSharedPointer<TService>, ServiceType::Transient,
+      typeid(ImplementationType));
+}
+
+inline std::unique_ptr<IServiceProviderRoot> ServiceCollection::build() & {
+  return build(ServiceProviderOptions{});
+}
+
+inline std::unique_ptr<IServiceProviderRoot> ServiceCollection::build(
+    const ServiceProviderOptions& options) & {
+  if (!_table) _table = std::make_shared<const ServiceTable>(_factories);
+  if (options.validateOnBuild) validate(*_table);
+  auto serviceProvider = std::make_unique<ServiceProvider>(_table, options);
+  if (options.warmUpThreads != 0)
+    serviceProvider->warmUp(options.warmUpThreads);
+  return serviceProvider;
+}
+
+inline std::unique_ptr<IServiceProviderRoot> ServiceCollection::build() && {
+  return std::move(*this).build(ServiceProviderOptions{});
+}
+
+inline std::unique_ptr<IServiceProviderRoot> ServiceCollection::build(
+    const ServiceProviderOptions& options) && {
+  if (!_table)
+    _table = std::make_shared<const ServiceTable>(std::move(_factories));
+  _factories.clear();
+  if (options.validateOnBuild) validate(*_table);
+  auto serviceProvider =
+      std::make_unique<ServiceProvider>(std::move(_table), options);
+  if (options.warmUpThreads != 0)
+    serviceProvider->warmUp(options.warmUpThreads);
+  return serviceProvider;
+}
+
+inline ServiceCollection::ServiceTable::ServiceTable(
+    ServiceRegistrations factories) {
+  const detail::IdDomain* const idDomain = detail::idDomain();
+  entries.reserve(factories.size());
+  entryIndices.reserve(factories.size());
+  for (auto& [type, registration] : factories) {
+    const bool foreign = registration.idDomain != idDomain;
+    const size_t typeId =
+        foreign ? detail::internServiceType(type) : registration.typeId;
+    if (typeId >= entryIndicesById.size())
+      entryIndicesById.resize(typeId + 1, 0);
+    entryIndicesById[typeId] = entries.size() + 1;
+    entryIndices.emplace(type, entries.size());
+    const size_t numberOfDescriptions = registration.descriptions.size();
+    entries.push_back(Entry{std::move(registration.descriptions),
+                            numberOfSlots, type, typeId, registration.idDomain,
+                            {}});
+    numberOfSlots += numberOfDescriptions;
+    auto& entry = entries.back();
+    for (size_t i = 0; i < numberOfDescriptions; ++i) {
+      size_t keyId = entry.descriptions[i].keyId;
+      if (keyId == 0) continue;
+      if (foreign) keyId = detail::internKey(entry.idDomain->keyNameOf(keyId));
+      if (keyId >= entry.keyedIndices.size())
+        entry.keyedIndices.resize(keyId + 1, 0);
+      entry.keyedIndices[keyId] = i + 1;
+    }
+  }
+  // entries is complete, so the plans can point into it
+  firstDependency.resize(numberOfSlots + 1);
+  entryOfSlot.resize(numberOfSlots);
+  lastImplementations.reserve(entries.size());
+  for (const auto& entry : entries)
+    lastImplementations.push_back(
+        Dependency{&entry, entry.descriptions.size() - 1});
+  scopedIndexOfSlot.resize(numberOfSlots, ~size_t{0});
+  scopedSetIndexOfEntry.resize(entries.size(), ~size_t{0});
+  for (const auto& entry : entries) {
+    if (std::any_of(entry.descriptions.begin(), entry.descriptions.end(),
+                    [](const ServiceDescription& desc) {
+                      return desc.type == ServiceType::Scoped;
+                    }))
+      scopedSetIndexOfEntry[&entry - entries.data()] = numberOfScopedSets++;
+    for (size_t i = 0; i < entry.descriptions.size(); ++i) {
+      firstDependency[entry.firstSlot + i] = dependencies.size();
+      entryOfSlot[entry.firstSlot + i] = &entry;
+      if (entry.descriptions[i].type == ServiceType::Scoped)
+        scopedIndexOfSlot[entry.firstSlot + i] = numberOfScopedSlots++;
+      const auto dependencyFunc = entry.descriptions[i].dependencies;
+      if (dependencyFunc == nullptr) continue;
+      const bool foreign = entry.idDomain != idDomain;
+      for (auto key : dependencyFunc()) {
+        if (foreign && key.typeId != 0)
+          key.typeId =
+              detail::internServiceType(entry.idDomain->typeOf(key.typeId));
+        dependencyKeys.push_back(key);
+        const Entry* dependency = key.typeId != 0 ? find(key.typeId) : nullptr;
+        // the service provider reports a mismatching life-time as missing
+        if (dependency != nullptr &&
+            (dependency->descriptions.back().type == ServiceType::Transient) !=
+                key.isTransient)
+          dependency = nullptr;
+        dependencies.push_back(
+            dependency != nullptr
+                ? Dependency{dependency, dependency->descriptions.size() - 1}
+                : Dependency{nullptr, 0});
+      }
+    }
+  }
+  firstDependency[numberOfSlots] = dependencies.size();
+  sortTopologically();
+}
+
+inline void ServiceCollection::ServiceTable::sortTopologically() {
+  enum State : char { Unvisited, Visiting, Visited };
+  std::vector<State> states(numberOfSlots, Unvisited);
+  // A depth first search, each frame holds a slot and its next dependency
+  std::vector<std::pair<size_t, size_t>> stack;
+  topologicalOrder.reserve(numberOfSlots);
+  for (size_t root = 0; root < numberOfSlots; ++root) {
+    if (states[root] != Unvisited) continue;
+    states[root] = Visiting;
+    stack.emplace_back(root, firstDependency[root]);
+    while (!stack.empty()) {
+      const auto [slot, next] = stack.back();
+      if (next == firstDependency[slot + 1]) {
+        states[slot] = Visited;
+        topologicalOrder.push_back(slot);
+        stack.pop_back();
+        continue;
+      }
+      ++stack.back().second;
+      const auto& dependency = dependencies[next];
+      if (dependency.entry == nullptr || dependencyKeys[next].isDeferred)
+        continue;
+      const size_t dependencySlot = slotOf(dependency);
+      if (states[dependencySlot] == Unvisited) {
+        states[dependencySlot] = Visiting;
+        stack.emplace_back(dependencySlot, firstDependency[dependencySlot]);
+      } else if (states[dependencySlot] == Visiting && cycle.empty()) {
+        auto frame = std::find_if(stack.begin(), stack.end(), [&](auto& f) {
+          return f.first == dependencySlot;
+        });
+        for (; frame != stack.end(); ++frame) cycle.push_back(frame->first);
+        cycle.push_back(dependencySlot);
+      }
+    }
+  }
+}
+
+inline std::string ServiceCollection::ServiceTable::nameOf(
+    size_t slot) const {
+  const Entry& entry = *entryOfSlot[slot];
+  const auto& desc = entry.descriptions[slot - entry.firstSlot];
+  const char* lifeTime = desc.type == ServiceType::Singleton ? " (singleton)"
+                         : desc.type == ServiceType::Scoped  ? " (scoped)"
+                                                             : " (transient)";
+  return desc.implementation->name() + std::string{lifeTime};
+}
+
+inline std::string ServiceCollection::ServiceTable::validate() const {
+  std::string problems;
+  for (size_t slot = 0; slot < numberOfSlots; ++slot) {
+    for (size_t i = firstDependency[slot]; i < firstDependency[slot + 1];
+         ++i) {
+      const auto& key = dependencyKeys[i];
+      if (key.typeId == 0 || dependencies[i].entry != nullptr) continue;
+      problems += nameOf(slot) + " depends on " + key.type->name() +
+                  ", which has not been registered as a " +
+                  (key.isTransient ? "transient service.\n"
+                                   : "singleton or scoped service.\n");
+    }
+  }
+  if (!cycle.empty()) {
+    problems += "Circular dependency: ";
+    for (size_t i = 0; i < cycle.size(); ++i)
+      problems += (i == 0 ? "" : " -> ") + nameOf(cycle[i]);
+    problems += "\n";
+  }
+  std::vector<size_t> scopedSlots;
+  std::vector<size_t> visited(numberOfSlots, ~size_t{0});
+  for (size_t slot = 0; slot < numberOfSlots; ++slot) {
+    const Entry& entry = *entryOfSlot[slot];
+    if (entry.descriptions[slot - entry.firstSlot].type !=
+        ServiceType::Singleton)
+      continue;
+    scopedSlots.clear();
+    findScopedDependencies(slot, scopedSlots, visited, slot);
+    for (size_t scopedSlot : scopedSlots)
+      problems += nameOf(slot) + " captures the scoped service " +
+                  nameOf(scopedSlot) + ".\n";
+  }
+  return problems;
+}
+
+inline void ServiceCollection::ServiceTable::findSingletonDependencies(
+    size_t slot, std::vector<size_t>& singletonSlots,
+    std::vector<size_t>& visited, size_t visitMark) const {
+  for (size_t i = firstDependency[slot]; i < firstDependency[slot + 1]; ++i) {
+    const auto& dependency = dependencies[i];
+    if (dependency.entry == nullptr || dependencyKeys[i].isDeferred) continue;
+    const size_t dependencySlot = slotOf(dependency);
+    if (visited[dependencySlot] == visitMark) continue;
+    visited[dependencySlot] = visitMark;
+    // other services are created on demand, look through them
+    if (dependency.entry->descriptions[dependency.index].type ==
+        ServiceType::Singleton)
+      singletonSlots.push_back(dependencySlot);
+    else
+      findSingletonDependencies(dependencySlot, singletonSlots, visited,
+                                visitMark);
+  }
+}
+
+inline void ServiceCollection::ServiceTable::findScopedDependencies(
+    size_t slot, std::vector<size_t>& scopedSlots,
+    std::vector<size_t>& visited, size_t visitMark) const {
+  for (size_t i = firstDependency[slot]; i < firstDependency[slot + 1]; ++i) {
+    const auto& dependency = dependencies[i];
+    if (dependency.entry == nullptr) continue;
+    const size_t dependencySlot = slotOf(dependency);
+    if (visited[dependencySlot] == visitMark) continue;
+    visited[dependencySlot] = visitMark;
+    // transient services are created in the same context, look through them
+    const ServiceType type =
+        dependency.entry->descriptions[dependency.index].type;
+    if (type == ServiceType::Scoped)
+      scopedSlots.push_back(dependencySlot);
+    else if (type == ServiceType::Transient)
+      findScopedDependencies(dependencySlot, scopedSlots, visited, visitMark);
+  }
+}
+
+inline size_t ServiceCollection::ServiceTable::memoryUsage() const {
+  size_t bytes = sizeof(ServiceTable) + entries.capacity() * sizeof(Entry) +
+                 entryIndicesById.capacity() * sizeof(size_t) +
+                 scopedIndexOfSlot.capacity() * sizeof(size_t) +
+                 scopedSetIndexOfEntry.capacity() * sizeof(size_t) +
+                 dependencies.capacity() * sizeof(Dependency) +
+                 firstDependency.capacity() * sizeof(size_t) +
+                 dependencyKeys.capacity() *
+                     sizeof(ServiceDescription::DependencyKey) +
+                 entryOfSlot.capacity() * sizeof(const Entry*) +
+                 topologicalOrder.capacity() * sizeof(size_t) +
+                 cycle.capacity() * sizeof(size_t) +
+                 lastImplementations.capacity() * sizeof(Dependency);
+  // a node per element and a pointer per bucket
+  bytes += entryIndices.size() *
+               (sizeof(void*) + sizeof(decltype(entryIndices)::value_type)) +
+           entryIndices.bucket_count() * sizeof(void*);
+  for (const auto& entry : entries)
+    bytes += entry.descriptions.capacity() * sizeof(ServiceDescription) +
+             entry.keyedIndices.capacity() * sizeof(size_t);
+  return bytes;
+}
+
+inline const ServiceCollection::ServiceTable::Entry*
+ServiceCollection::ServiceTable::find(std::type_index type) const {
+  auto it = entryIndices.find(type);
+  if (it == entryIndices.end()) return nullptr;
+  return &entries[it->second];
+}
+
+inline const ServiceCollection::ServiceTable::Entry*
+ServiceCollection::ServiceTable::find(size_t typeId) const {
+  if (typeId >= entryIndicesById.size() || entryIndicesById[typeId] == 0)
+    return nullptr;
+  return &entries[entryIndicesById[typeId] - 1];
 }
 
-inline std::unique_ptr<IServiceProviderRoot> ServiceCollection::build() {
-  return std::make_unique<ServiceProvider>(_factories);
+inline const ServiceCollection::ServiceTable::Dependency*
+ServiceCollection::ServiceTable::lastImplementationOf(size_t typeId) const {
+  const Entry* entry = find(typeId);
+  if (entry == nullptr ||
+      entry->descriptions.back().type == ServiceType::Transient)
+    return nullptr;
+  return &lastImplementations[entry - entries.data()];
 }
 
 template <class TServiceProvider>
-inline std::any
-ServiceCollection::ServiceProvider::ScopedServiceProvider::getService(
-    const std::pair<std::type_index, FactoryFunctionCollection>& factories,
-    TServiceProvider& serviceProviderForThisService,
-    IServiceProvider& serviceProviderForDependentSerices, size_t index) {
-  const auto& desc = factories.second.at(index);
-  if (desc.type == ServiceType::Singleton || desc.type == ServiceType::Scoped) {
-    std::unique_lock instancesLock(
-        serviceProviderForThisService._instancesMutex);
-    auto instancesPair = serviceProviderForThisService._instances.emplace(
-        factories.first, std::unique_ptr<ConcurrentService[]>{});
-    if (instancesPair.second)
-      instancesPair.first->second =
-          std::make_unique<ConcurrentService[]>(factories.second.size());
-    ConcurrentService* instances = instancesPair.first->second.get();
-    instancesLock.unlock();
-    bool expected = false;
-    if (instances[index].initialized.compare_exchange_strong(expected, true)) {
-      instances[index].servicePromise.set_value(
-          desc.create(serviceProviderForDependentSerices));
-      std::scoped_lock lock{
-          serviceProviderForThisService._initializationOrderMutex};
-      serviceProviderForThisService._initializationOrder.emplace_back(
-          instances[index].serviceFuture.get());
-    }
-    return desc.convert(instances[index].serviceFuture.get());
-  } else  // ServiceType::Transient
-  {
-    return desc.convert(desc.create(serviceProviderForDependentSerices));
+inline void*
+ServiceCollection::ServiceProvider::ScopedServiceProvider::getInstance(
+    const ServiceTable::Entry& entry, TServiceProvider& serviceProvider,
+    size_t index) {
+  const size_t slot = entry.firstSlot + index;
+  detail::OnceCell& instance = serviceProvider.instanceOf(slot);
+  const bool singleThreaded = serviceProvider.singleThreaded();
+#ifdef CPPINJECT_INSTRUMENTATION
+  std::optional<std::chrono::nanoseconds> creationTime;
+  const auto start = std::chrono::steady_clock::now();
+#endif
+  auto create = [&]() -> void* {
+    // shared with the parent service provider, which owns the instance
+    if (void* inherited = serviceProvider.inheritedInstance(slot))
+      return inherited;
+    const auto& desc = entry.descriptions[index];
+    // owned by the AsyncInstance
+    if (desc.createAsync != nullptr)
+      return serviceProvider.root().getAsyncInstance(entry, index)->get();
+    const auto created = [&] {
+      if constexpr (std::is_same_v<TServiceProvider, ServiceProvider>) {
+        const CreatingInstance creating{serviceProvider};
+        return desc.createOwned(serviceProvider.creationContext(slot));
+      } else {
+        return desc.createOwned(serviceProvider.creationContext(slot));
+      }
+    }();
+    void* service = desc.convert(created.implementation);
+#ifdef CPPINJECT_INSTRUMENTATION
+    creationTime = std::chrono::steady_clock::now() - start;
+#endif
+    const CreatedInstance createdInstance{slot, created.owner, created.destroy};
+    serviceProvider.recordLogIndex(
+        slot, singleThreaded ? serviceProvider._initializationOrder
+                                   .pushUnsynchronized(createdInstance)
+                             : serviceProvider._initializationOrder.push(
+                                   createdInstance));
+    return service;
+  };
+  void* service = singleThreaded ? instance.getOrInitUnsynchronized(create)
+                                 : instance.getOrInit(create);
+#ifdef CPPINJECT_INSTRUMENTATION
+  serviceProvider.root().recordResolution(
+      entry, index, creationTime.value_or(std::chrono::nanoseconds{0}),
+      !creationTime.has_value());
+#endif
+  return service;
+}
+
+template <class TServiceProvider>
+inline std::vector<void*>*
+ServiceCollection::ServiceProvider::ScopedServiceProvider::createServiceSet(
+    const ServiceTable::Entry& entry, TServiceProvider& serviceProvider) {
+  auto services = std::make_unique<std::vector<void*>>();
+  services->reserve(entry.descriptions.size());
+  for (size_t i = 0; i < entry.descriptions.size(); ++i) {
+    if (entry.descriptions[i].type == ServiceType::Transient) continue;
+    // the root service provider pins the set, not its instances, see
+    // ServiceProvider::getServiceSpanById
+    if constexpr (std::is_same_v<TServiceProvider, ServiceProvider>)
+      services->push_back(getInstance(entry, serviceProvider, i));
+    else
+      services->push_back(serviceProvider.getInstance(entry, i));
   }
+  return services.release();
+}
+
+inline void
+ServiceCollection::ServiceProvider::ScopedServiceProvider::releaseServiceSets(
+    detail::OnceCell* serviceSets, size_t numberOfEntries) {
+  for (size_t i = 0; i < numberOfEntries; ++i) {
+    delete static_cast<std::vector<void*>*>(serviceSets[i].tryGet());
+    serviceSets[i].reset();
+  }
+}
+
+inline size_t ServiceCollection::ServiceProvider::ScopedServiceProvider::
+    serviceSetsMemoryUsage(const detail::OnceCell* serviceSets,
+                           size_t numberOfEntries) {
+  size_t bytes = numberOfEntries * sizeof(detail::OnceCell);
+  for (size_t i = 0; i < numberOfEntries; ++i)
+    if (const auto* services =
+            static_cast<const std::vector<void*>*>(serviceSets[i].tryGet()))
+      bytes +=
+          sizeof(std::vector<void*>) + services->capacity() * sizeof(void*);
+  return bytes;
+}
+
+template <class TServiceProvider>
+inline std::shared_ptr<void>
+ServiceCollection::ServiceProvider::ScopedServiceProvider::createInstance(
+    const ServiceTable::Entry& entry, TServiceProvider& serviceProvider,
+    size_t index) {
+  const auto& desc = entry.descriptions[index];
+#ifdef CPPINJECT_INSTRUMENTATION
+  const auto start = std::chrono::steady_clock::now();
+#endif
+  auto implementation =
+      desc.create(serviceProvider.creationContext(entry.firstSlot + index));
+  void* service = desc.convert(implementation.get());
+#ifdef CPPINJECT_INSTRUMENTATION
+  serviceProvider.root().recordResolution(
+      entry, index, std::chrono::steady_clock::now() - start, false);
+#endif
+  return std::shared_ptr<void>(std::move(implementation), service);
+}
+
+template <class TServiceProvider>
+inline void*
+ServiceCollection::ServiceProvider::ScopedServiceProvider::createUniqueInstance(
+    const ServiceTable::Entry& entry, TServiceProvider& serviceProvider,
+    size_t index) {
+  const auto& desc = entry.descriptions[index];
+#ifdef CPPINJECT_INSTRUMENTATION
+  const auto start = std::chrono::steady_clock::now();
+#endif
+  void* service = desc.createUnique(
+      serviceProvider.creationContext(entry.firstSlot + index));
+#ifdef CPPINJECT_INSTRUMENTATION
+  serviceProvider.root().recordResolution(
+      entry, index, std::chrono::steady_clock::now() - start, false);
+#endif
+  return service;
 }
 
 inline std::any ServiceCollection::ServiceProvider::getService(
     std::type_index type) {
-  auto factoryIt = _factories.find(type);
-  if (factoryIt == _factories.end()) return std::any();
-  return ScopedServiceProvider::getService(*factoryIt, *this, *this,
-                                           factoryIt->second.size() - 1);
+  const auto* entry = _table->find(type);
+  if (entry == nullptr) return std::any();
+  return getService(entry, entry->descriptions.size() - 1);
 }
 
 inline std::vector<std::any> ServiceCollection::ServiceProvider::getServices(
     std::type_index type) {
   std::vector<std::any> res;
-  auto factoryIt = _factories.find(type);
-  if (factoryIt == _factories.end()) return res;
-  for (size_t i = 0; i < factoryIt->second.size(); ++i)
-    res.emplace_back(
-        ScopedServiceProvider::getService(*factoryIt, *this, *this, i));
+  const auto* entry = _table->find(type);
+  if (entry == nullptr) return res;
+  res.reserve(entry->descriptions.size());
+  for (size_t i = 0; i < entry->descriptions.size(); ++i)
+    res.emplace_back(getService(entry, i));
   return res;
 }
 
+inline void* ServiceCollection::ServiceProvider::getServiceById(
+    size_t typeId) {
+  return getServiceById(*this, typeId);
+}
+
+template <class TServiceProvider>
+inline void* ServiceCollection::ServiceProvider::getServiceById(
+    TServiceProvider& serviceProvider, size_t typeId) {
+  // loaded before the instance, so a replaced singleton is only cached under
+  // the id of the service provider it was replaced in
+  const uint64_t id =
+      _threadLocalSingletonCache ? _id.load(std::memory_order_acquire) : 0;
+  constexpr bool isRoot = std::is_same_v<TServiceProvider, ServiceProvider>;
+  // cached instances are not captured by the singletons being created
+  const bool useCache =
+      _threadLocalSingletonCache && !(isRoot && _creatingProvider == this);
+  if (useCache) {
+    // the root only uses the instances it has pinned, see _pins
+    void* cached = detail::ThreadLocalServiceCache::find(id, typeId, isRoot);
+    if (cached != nullptr) {
+#ifdef CPPINJECT_INSTRUMENTATION
+      const auto* entry = _table->find(typeId);
+      recordResolution(*entry, entry->descriptions.size() - 1,
+                       std::chrono::nanoseconds{0}, true);
+#endif
+      return cached;
+    }
+  }
+  const auto* entry = _table->find(typeId);
+  if (entry == nullptr) return nullptr;
+  const size_t index = entry->descriptions.size() - 1;
+  const ServiceType type = entry->descriptions[index].type;
+  if (type == ServiceType::Transient) return nullptr;
+  void* service = serviceProvider.getInstance(*entry, index);
+  if (useCache && type == ServiceType::Singleton)
+    detail::ThreadLocalServiceCache::insert(id, typeId, service, isRoot);
+  return service;
+}
+
+inline std::vector<void*> ServiceCollection::ServiceProvider::getServicesById(
+    size_t typeId) {
+  std::vector<void*> res;
+  const auto* entry = _table->find(typeId);
+  if (entry == nullptr) return res;
+  res.reserve(entry->descriptions.size());
+  for (size_t i = 0; i < entry->descriptions.size(); ++i)
+    if (entry->descriptions[i].type != ServiceType::Transient)
+      res.push_back(getInstance(*entry, i));
+  return res;
+}
+
+inline std::span<void* const>
+ServiceCollection::ServiceProvider::getServiceSpanById(size_t typeId) {
+  const auto* entry = _table->find(typeId);
+  if (entry == nullptr) return {};
+  // the span refers to the last implementation, which can be replaced
+  const size_t entryIndex = entry - _table->entries.data();
+  return resolveOutsideScopes(
+      entry->firstSlot + entry->descriptions.size() - 1,
+      [&] { return getServiceSet(*entry); },
+      [&](std::span<void* const> services) {
+        return static_cast<std::vector<void*>*>(
+                   _serviceSets[entryIndex].tryGet())
+                   ->data() == services.data();
+      });
+}
+
+inline std::shared_ptr<void>
+ServiceCollection::ServiceProvider::getTransientServiceById(size_t typeId) {
+  const auto* entry = _table->find(typeId);
+  if (entry == nullptr ||
+      entry->descriptions.back().type != ServiceType::Transient)
+    return nullptr;
+  return ScopedServiceProvider::createInstance(*entry, *this,
+                                               entry->descriptions.size() - 1);
+}
+
+inline std::vector<std::shared_ptr<void>>
+ServiceCollection::ServiceProvider::getTransientServicesById(size_t typeId) {
+  std::vector<std::shared_ptr<void>> res;
+  const auto* entry = _table->find(typeId);
+  if (entry == nullptr) return res;
+  res.reserve(entry->descriptions.size());
+  for (size_t i = 0; i < entry->descriptions.size(); ++i)
+    if (entry->descriptions[i].type == ServiceType::Transient)
+      res.push_back(ScopedServiceProvider::createInstance(*entry, *this, i));
+  return res;
+}
+
+inline void* ServiceCollection::ServiceProvider::createUniqueServiceById(
+    size_t typeId) {
+  const auto* entry = _table->find(typeId);
+  if (entry == nullptr || entry->descriptions.back().createUnique == nullptr)
+    return nullptr;
+  return ScopedServiceProvider::createUniqueInstance(
+      *entry, *this, entry->descriptions.size() - 1);
+}
+
+inline void* ServiceCollection::ServiceProvider::getKeyedServiceById(
+    size_t typeId, size_t keyId) {
+  const auto* entry = _table->find(typeId);
+  if (entry == nullptr) return nullptr;
+  const size_t index = entry->indexOfKey(keyId);
+  if (index >= entry->descriptions.size() ||
+      entry->descriptions[index].type == ServiceType::Transient)
+    return nullptr;
+  return getInstance(*entry, index);
+}
+
+inline std::shared_ptr<void>
+ServiceCollection::ServiceProvider::getKeyedTransientServiceById(
+    size_t typeId, size_t keyId) {
+  const auto* entry = _table->find(typeId);
+  if (entry == nullptr) return nullptr;
+  const size_t index = entry->indexOfKey(keyId);
+  if (index >= entry->descriptions.size() ||
+      entry->descriptions[index].type != ServiceType::Transient)
+    return nullptr;
+  return ScopedServiceProvider::createInstance(*entry, *this, index);
+}
+
+inline void* ServiceCollection::ServiceProvider::getInstance(
+    const ServiceTable::Entry& entry, size_t index) {
+  const size_t slot = entry.firstSlot + index;
+  return resolveOutsideScopes(
+      slot,
+      [&] { return ScopedServiceProvider::getInstance(entry, *this, index); },
+      [&](void* service) { return _instances[slot].tryGet() == service; });
+}
+
+inline void ServiceCollection::ServiceProvider::pinAllInstances(size_t slot) {
+  if ((_pins[slot].load(std::memory_order_acquire) & allInstancesPinned) != 0)
+    return;
+  std::lock_guard lock{_replacementMutex};
+  _pins[slot].fetch_or(allInstancesPinned, std::memory_order_release);
+}
+
+inline std::span<void* const>
+ServiceCollection::ServiceProvider::getServiceSet(
+    const ServiceTable::Entry& entry) {
+  void* serviceSet =
+      _serviceSets[&entry - _table->entries.data()].getOrInit([&] {
+        return ScopedServiceProvider::createServiceSet(entry, *this);
+      });
+  return *static_cast<std::vector<void*>*>(serviceSet);
+}
+
+template <class F, class G>
+inline std::invoke_result_t<F>
+ServiceCollection::ServiceProvider::resolveOutsideScopes(size_t slot,
+                                                         F&& resolve,
+                                                         G&& isCurrent) {
+  const uint64_t pins = _pins[slot].load(std::memory_order_acquire);
+  if ((pins & (currentInstancePinned | allInstancesPinned)) != 0) {
+    auto resolved = resolve();
+    // replacements change the pins before the instance
+    if ((pins & allInstancesPinned) != 0 ||
+        _pins[slot].load(std::memory_order_acquire) == pins)
+      return resolved;
+  }
+  const bool creating = _creatingProvider == this;
+  while (true) {
+    auto resolved = resolve();
+    std::lock_guard lock{_replacementMutex};
+    // replaced after it was resolved
+    if (!isCurrent(resolved)) continue;
+    if (creating)
+      _captured[slot] = true;
+    else
+      _pins[slot].fetch_or(currentInstancePinned, std::memory_order_release);
+    return resolved;
+  }
+}
+
+inline detail::AsyncInstance*
+ServiceCollection::ServiceProvider::getAsyncInstance(
+    const ServiceTable::Entry& entry, size_t index) {
+  const size_t slot = entry.firstSlot + index;
+  return static_cast<detail::AsyncInstance*>(
+      _asyncInstances[slot].getOrInit([&]() -> void* {
+        return entry.descriptions[index].createAsync(creationContext(slot),
+                                                     _initializationOrder);
+      }));
+}
+
+inline detail::PendingService
+ServiceCollection::ServiceProvider::getServiceAsyncById(size_t typeId) {
+  const auto* entry = _table->find(typeId);
+  if (entry != nullptr && entry->descriptions.back().createAsync != nullptr) {
+    const size_t index = entry->descriptions.size() - 1;
+    if (void* service = _instances[entry->firstSlot + index].tryGet())
+      return {nullptr, service};
+    return {getAsyncInstance(*entry, index), nullptr};
+  }
+  return {nullptr, getServiceById(typeId)};
+}
+
+inline void ServiceCollection::ServiceProvider::resolveByIds(
+    std::span<const size_t> typeIds, std::span<void*> services) {
+  // the plans are looked up once and their cells loaded directly, without
+  // the thread-local cache
+  for (size_t i = 0; i < typeIds.size(); ++i) {
+    const auto* dependency = _table->lastImplementationOf(typeIds[i]);
+    services[i] = dependency != nullptr
+                      ? getInstance(*dependency->entry, dependency->index)
+                      : nullptr;
+  }
+}
+
+inline size_t ServiceCollection::ServiceProvider::memoryUsage() const {
+  const size_t numberOfSlots = _table->numberOfSlots;
+  const size_t scopePoolCapacity =
+      std::min(_options.scopePoolCapacity, detail::IndexFreeList::maxCapacity);
+  size_t bytes =
+      sizeof(ServiceProvider) + _table->memoryUsage() +
+      numberOfSlots * (sizeof(CreatedInstance) + sizeof(detail::OnceCell) +
+                       sizeof(std::shared_ptr<void>)) +
+      ScopedServiceProvider::serviceSetsMemoryUsage(_serviceSets.get(),
+                                                    _table->entries.size()) +
+      scopePoolCapacity * sizeof(std::optional<ScopedServiceProvider>);
+  // the pooled scopes keep their slots, logs and arenas while they are idle
+  for (size_t i = 0; i < scopePoolCapacity; ++i)
+    if (_scopePool[i].has_value())
+      bytes += _scopePool[i]->memoryUsage() - sizeof(ScopedServiceProvider);
+  if (_inherited != nullptr) bytes += numberOfSlots * sizeof(InheritedInstance);
+  if (_asyncInstances != nullptr)
+    bytes += numberOfSlots * sizeof(detail::OnceCell);
+  bytes += numberOfSlots *
+           (sizeof(size_t) + sizeof(bool) + sizeof(std::atomic<uint64_t>));
+#ifdef CPPINJECT_INSTRUMENTATION
+  bytes += numberOfSlots * sizeof(detail::ResolutionCounters);
+#endif
+  return bytes;
+}
+
+inline detail::ResolverSlot
+ServiceCollection::ServiceProvider::getResolverById(size_t typeId) {
+  const auto* dependency = _table->lastImplementationOf(typeId);
+  if (dependency == nullptr) return {};
+  // the resolver may be called at any time
+  pinAllInstances(_table->slotOf(*dependency));
+  return {&_instances[_table->slotOf(*dependency)], this, dependency,
+          &CreationContext::getServiceInRoot};
+}
+
+inline size_t ServiceCollection::ServiceProvider::getServiceTypeId(
+    std::type_index type) {
+  const auto* entry = _table->find(type);
+  return entry != nullptr ? entry->typeId : 0;
+}
+
+inline size_t ServiceCollection::ServiceProvider::getKeyId(
+    std::string_view name) {
+  return detail::internKey(name);
+}
+
+inline ServiceCollection::CreationContext
+ServiceCollection::ServiceProvider::creationContext(size_t slot) {
+  return CreationContext{*this, arena(), _table->planOf(slot), *this, nullptr,
+                         slot};
+}
+
+inline std::any ServiceCollection::ServiceProvider::getService(
+    const ServiceTable::Entry* entry, size_t index) {
+  const auto& desc = entry->descriptions[index];
+  if (desc.type == ServiceType::Transient)
+    return desc.box(
+        ScopedServiceProvider::createInstance(*entry, *this, index));
+  return desc.box(std::shared_ptr<void>(std::shared_ptr<void>{},
+                                        getInstance(*entry, index)));
+}
+
+inline ServiceCollection::ServiceProvider::ServiceProvider(
+    std::shared_ptr<const ServiceTable> table,
+    const ServiceProviderOptions& options)
+    : _table(std::move(table)),
+      _options(options),
+      _initializationOrder(_table->numberOfSlots),
+      _instances(std::make_unique<detail::OnceCell[]>(_table->numberOfSlots)),
+      _serviceSets(
+          std::make_unique<detail::OnceCell[]>(_table->entries.size())),
+      _logIndexOfSlot(std::make_unique<size_t[]>(_table->numberOfSlots)),
+      _scopeArenaSize(options.scopeArenaSize),
+      _id(detail::ThreadLocalServiceCache::nextProviderId()),
+      _threadLocalSingletonCache(options.threadLocalSingletonCache),
+      _scopePool(std::make_unique<std::optional<ScopedServiceProvider>[]>(
+          std::min(options.scopePoolCapacity,
+                   detail::IndexFreeList::maxCapacity))),
+      _freeScopes(options.scopePoolCapacity) {
+  _pools = std::make_unique<std::shared_ptr<void>[]>(_table->numberOfSlots);
+  _captured = std::make_unique<bool[]>(_table->numberOfSlots);
+  _pins = std::make_unique<std::atomic<uint64_t>[]>(_table->numberOfSlots);
+  for (const auto& entry : _table->entries)
+    for (size_t i = 0; i < entry.descriptions.size(); ++i)
+      if (const auto& desc = entry.descriptions[i]; desc.createPool != nullptr)
+        _pools[entry.firstSlot + i] = desc.createPool(desc.poolCapacity);
+      else if (desc.createAsync != nullptr && _asyncInstances == nullptr)
+        _asyncInstances =
+            std::make_unique<detail::OnceCell[]>(_table->numberOfSlots);
+#ifdef CPPINJECT_INSTRUMENTATION
+  _counters =
+      std::make_unique<detail::ResolutionCounters[]>(_table->numberOfSlots);
+  _observer = options.resolutionObserver;
+#endif
+}
+
+#ifdef CPPINJECT_INSTRUMENTATION
+inline std::vector<ServiceStatistics>
+ServiceCollection::ServiceProvider::statistics() const {
+  std::vector<ServiceStatistics> res;
+  res.reserve(_table->numberOfSlots);
+  for (const auto& entry : _table->entries) {
+    for (size_t i = 0; i < entry.descriptions.size(); ++i) {
+      const auto& desc = entry.descriptions[i];
+      const auto& counters = _counters[entry.firstSlot + i];
+      res.push_back(ServiceStatistics{
+          entry.type, desc.implementation, desc.type, i,
+          counters.resolutions.load(std::memory_order_relaxed),
+          counters.creations.load(std::memory_order_relaxed),
+          std::chrono::nanoseconds{
+              counters.creationNanoseconds.load(std::memory_order_relaxed)}});
+    }
+  }
+  return res;
+}
+
+inline void ServiceCollection::ServiceProvider::recordResolution(
+    const ServiceTable::Entry& entry, size_t index,
+    std::chrono::nanoseconds creationTime, bool cacheHit) {
+  _counters[entry.firstSlot + index].record(creationTime, cacheHit);
+  if (_observer == nullptr) return;
+  const auto& desc = entry.descriptions[index];
+  _observer->onResolution(ResolutionEvent{
+      entry.type, desc.implementation, desc.type, index,
+      std::this_thread::get_id(), creationTime, cacheHit});
+}
+#endif
+
+inline std::unique_ptr<IServiceProviderRoot>
+ServiceCollection::ServiceProvider::createChild(
+    const ServiceCollection& overrides) {
+  // overrides replace all registrations of their service types
+  ServiceRegistrations registrations = overrides._factories;
+  for (const auto& entry : _table->entries)
+    registrations.try_emplace(
+        entry.type, ServiceRegistration{entry.typeId, entry.idDomain,
+                                        entry.descriptions});
+  auto table = std::make_shared<const ServiceTable>(std::move(registrations));
+  if (_options.validateOnBuild) validate(*table);
+  auto child = std::make_unique<ServiceProvider>(std::move(table), _options);
+  child->inheritSingletons(*this, overrides._factories);
+  if (_options.warmUpThreads != 0) child->warmUp(_options.warmUpThreads);
+  return child;
+}
+
+inline void ServiceCollection::ServiceProvider::inheritSingletons(
+    ServiceProvider& parent, const ServiceRegistrations& overrides) {
+  const ServiceTable& table = *_table;
+  // A slot is shared if it creates the same instance as in the parent: its
+  // registration is not overridden and all of its planned dependencies are
+  // shared. Factory functions resolve dependencies that are not planned.
+  std::vector<char> shared(table.numberOfSlots, 0);
+  for (const auto& entry : table.entries) {
+    if (overrides.count(entry.type) != 0) continue;
+    for (size_t i = 0; i < entry.descriptions.size(); ++i) {
+      const auto& desc = entry.descriptions[i];
+      shared[entry.firstSlot + i] =
+          desc.type != ServiceType::Scoped && desc.dependencies != nullptr;
+    }
+  }
+  // dependencies come first in the topological order, so only deferred
+  // dependencies need another pass
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (const size_t slot : table.topologicalOrder) {
+      if (!shared[slot]) continue;
+      for (size_t i = table.firstDependency[slot];
+           i < table.firstDependency[slot + 1]; ++i) {
+        const auto& dependency = table.dependencies[i];
+        if (dependency.entry != nullptr && shared[table.slotOf(dependency)])
+          continue;
+        shared[slot] = 0;
+        changed = true;
+        break;
+      }
+    }
+  }
+  _parentProvider = &parent;
+  _inherited = std::make_unique<InheritedInstance[]>(table.numberOfSlots);
+  for (const auto& entry : table.entries) {
+    const auto* parentEntry = parent._table->find(entry.type);
+    for (size_t i = 0; i < entry.descriptions.size(); ++i) {
+      const size_t slot = entry.firstSlot + i;
+      if (shared[slot] && entry.descriptions[i].type == ServiceType::Singleton)
+        _inherited[slot] = InheritedInstance{parentEntry, i};
+    }
+  }
+}
+
 inline std::unique_ptr<IServiceProvider>
 ServiceCollection::ServiceProvider::createScope() {
-  return std::make_unique<ScopedServiceProvider>(*this);
+  return createScope(ScopeMode::Concurrent);
+}
+
+inline std::unique_ptr<IServiceProvider>
+ServiceCollection::ServiceProvider::createScope(ScopeMode mode) {
+  const size_t poolIndex = _freeScopes.pop();
+  if (poolIndex == detail::IndexFreeList::npos) {
+    auto scope = std::make_unique<ScopedServiceProvider>(*this);
+    scope->setMode(mode);
+    scope->enter();
+    return scope;
+  }
+  auto& scope = _scopePool[poolIndex];
+  if (!scope) scope.emplace(*this, poolIndex);
+  scope->setMode(mode);
+  scope->enter();
+  return std::unique_ptr<IServiceProvider>(&*scope);
+}
+
+inline void ServiceCollection::ServiceProvider::warmUp(
+    size_t numberOfThreads) {
+  // start all asynchronous singletons first, so their creations overlap
+  if (_asyncInstances != nullptr)
+    for (const auto& entry : _table->entries)
+      for (size_t i = 0; i < entry.descriptions.size(); ++i)
+        if (entry.descriptions[i].createAsync != nullptr)
+          getAsyncInstance(entry, i);
+  if (numberOfThreads <= 1 && _table->cycle.empty()) {
+    // every singleton is created after the singletons it depends on
+    for (size_t slot : _table->topologicalOrder) {
+      const auto& entry = *_table->entryOfSlot[slot];
+      const size_t index = slot - entry.firstSlot;
+      if (entry.descriptions[index].type == ServiceType::Singleton)
+        ScopedServiceProvider::getInstance(entry, *this, index);
+    }
+    return;
+  }
+
+  // The singletons form a graph, each node waits for the singletons it
+  // depends on before it becomes ready to be created.
+  struct Node {
+    const ServiceTable::Entry* entry;
+    size_t index;
+    size_t pendingDependencies = 0;
+    std::vector<size_t> dependents;
+  };
+  constexpr size_t noNode = ~size_t{0};
+  std::vector<Node> nodes;
+  std::vector<size_t> nodeOfSlot(_table->numberOfSlots, noNode);
+  for (const auto& entry : _table->entries)
+    for (size_t i = 0; i < entry.descriptions.size(); ++i)
+      if (entry.descriptions[i].type == ServiceType::Singleton &&
+          _instances[entry.firstSlot + i].tryGet() == nullptr) {
+        nodeOfSlot[entry.firstSlot + i] = nodes.size();
+        nodes.push_back(Node{&entry, i, 0, {}});
+      }
+  if (nodes.empty()) return;
+
+  std::vector<size_t> singletonSlots;
+  std::vector<size_t> visited(_table->numberOfSlots, noNode);
+  for (size_t n = 0; n < nodes.size(); ++n) {
+    singletonSlots.clear();
+    const size_t nodeSlot = nodes[n].entry->firstSlot + nodes[n].index;
+    _table->findSingletonDependencies(nodeSlot, singletonSlots, visited, n);
+    for (size_t slot : singletonSlots) {
+      const size_t dependency = nodeOfSlot[slot];
+      if (dependency == noNode || dependency == n) continue;
+      nodes[dependency].dependents.push_back(n);
+      ++nodes[n].pendingDependencies;
+    }
+  }
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::vector<size_t> ready;
+  for (size_t n = 0; n < nodes.size(); ++n)
+    if (nodes[n].pendingDependencies == 0) ready.push_back(n);
+  size_t remaining = nodes.size();
+  size_t running = 0;
+  std::exception_ptr error;
+
+  auto worker = [&] {
+    std::unique_lock lock{mutex};
+    while (true) {
+      changed.wait(lock, [&] {
+        return !ready.empty() || remaining == 0 || error || running == 0;
+      });
+      if (remaining == 0 || error) return;
+      if (ready.empty()) {
+        // nothing is running and nothing can become ready
+        error = std::make_exception_ptr(std::logic_error(
+            "The singleton services have circular dependencies."));
+        changed.notify_all();
+        return;
+      }
+      const size_t n = ready.back();
+      ready.pop_back();
+      ++running;
+      lock.unlock();
+      try {
+        ScopedServiceProvider::getInstance(*nodes[n].entry, *this,
+                                           nodes[n].index);
+      } catch (...) {
+        lock.lock();
+        --running;
+        if (!error) error = std::current_exception();
+        changed.notify_all();
+        return;
+      }
+      lock.lock();
+      --running;
+      --remaining;
+      for (size_t dependent : nodes[n].dependents)
+        if (--nodes[dependent].pendingDependencies == 0)
+          ready.push_back(dependent);
+      changed.notify_all();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  const size_t numberOfHelpers =
+      std::min(std::max(numberOfThreads, size_t{1}), nodes.size()) - 1;
+  threads.reserve(numberOfHelpers);
+  for (size_t i = 0; i < numberOfHelpers; ++i) threads.emplace_back(worker);
+  worker();
+  for (auto& thread : threads) thread.join();
+  if (error) std::rethrow_exception(error);
 }
 
 inline ServiceCollection::ServiceProvider::~ServiceProvider() {
-  _instances.clear();
-  while (!_initializationOrder.empty()) _initializationOrder.pop_back();
+  // running asynchronous factories may still resolve services
+  if (_asyncInstances != nullptr) {
+    for (size_t slot = 0; slot < _table->numberOfSlots; ++slot) {
+      auto* instance =
+          static_cast<detail::AsyncInstance*>(_asyncInstances[slot].tryGet());
+      try {
+        // logs failed instances as well
+        if (instance != nullptr) instance->get();
+      } catch (...) {
+      }
+    }
+  }
+  _scopePool.reset();
+  // idle pooled instances may depend on singletons
+  _pools.reset();
+  ScopedServiceProvider::releaseServiceSets(_serviceSets.get(),
+                                            _table->entries.size());
+  _instances.reset();
+  // no scope is left that could use the retired instances
+  for (auto it = _retired.rbegin(); it != _retired.rend(); ++it)
+    it->created.release();
+  if (_replacements.empty()) {
+    _initializationOrder.popAll(
+        [](const CreatedInstance& created) { created.release(); });
+  } else {
+    // replaced singletons are destroyed in the position of the original
+    _initializationOrder.popAll([this](const CreatedInstance& created) {
+      releaseReplacements(created.slot);
+      created.release();
+    });
+    // inherited singletons that have been replaced have not been logged
+    while (!_replacements.empty())
+      releaseReplacements(_replacements.begin()->first);
+  }
+}
+
+inline void ServiceCollection::ServiceProvider::releaseReplacements(
+    size_t slot) {
+  const auto it = _replacements.find(slot);
+  if (it == _replacements.end()) return;
+  const auto versions = std::move(it->second);
+  _replacements.erase(it);
+  for (auto version = versions.rbegin(); version != versions.rend(); ++version)
+    version->release();
+}
+
+inline void ServiceCollection::ServiceProvider::releaseRetired() {
+  std::vector<RetiredInstance> released;
+  {
+    std::lock_guard lock{_replacementMutex};
+    uint64_t oldestEpoch = ~uint64_t{0};
+    for (const auto* epoch : _scopeEpochs)
+      if (const uint64_t e = epoch->load(std::memory_order_seq_cst); e != 0)
+        oldestEpoch = std::min(oldestEpoch, e);
+    // an instance retired in an epoch is still used by the scopes that were
+    // created in that epoch or earlier
+    const auto firstReleased = std::stable_partition(
+        _retired.begin(), _retired.end(),
+        [&](const RetiredInstance& retired) {
+          return retired.epoch >= oldestEpoch;
+        });
+    released.assign(firstReleased, _retired.end());
+    _retired.erase(firstReleased, _retired.end());
+    _numberOfRetired.store(_retired.size(), std::memory_order_seq_cst);
+  }
+  for (auto it = released.rbegin(); it != released.rend(); ++it)
+    it->created.release();
+}
+
+inline void ServiceCollection::ServiceProvider::replaceSingletonById(
+    size_t typeId, std::shared_ptr<void> service) {
+  const auto* dependency = _table->lastImplementationOf(typeId);
+  if (dependency == nullptr ||
+      dependency->entry->descriptions[dependency->index].type !=
+          ServiceType::Singleton)
+    throw std::logic_error(
+        "The service has not been registered as a singleton.");
+  // a running factory would create the instance again
+  if (dependency->entry->descriptions[dependency->index].createAsync !=
+      nullptr)
+    throw std::logic_error("Asynchronous singletons cannot be replaced.");
+  const auto& entry = *dependency->entry;
+  const size_t slot = _table->slotOf(*dependency);
+  void* replacement = service.get();
+  auto owner = std::make_unique<std::shared_ptr<void>>(std::move(service));
+  constexpr ServiceDescription::DestroyFunction destroyOwner = [](void* owner) {
+    delete static_cast<std::shared_ptr<void>*>(owner);
+  };
+  // a singleton that has not been created yet is simply created from the
+  // replacement
+  bool initialized = false;
+  _instances[slot].getOrInit([&]() -> void* {
+    recordLogIndex(slot, _initializationOrder.push(
+                             CreatedInstance{slot, owner.get(), destroyOwner}));
+    owner.release();
+    initialized = true;
+    return replacement;
+  });
+  if (initialized) return;
+  // waits for a service set that is being created
+  const size_t entryIndex = &entry - _table->entries.data();
+  if (!_serviceSets[entryIndex].empty()) getServiceSet(entry);
+
+  std::unique_lock lock{_replacementMutex};
+  // a new version, whose instance has not been pinned yet
+  const uint64_t pins = _pins[slot].load(std::memory_order_relaxed);
+  _pins[slot].store((((pins >> pinVersionShift) + 1) << pinVersionShift) |
+                        (pins & allInstancesPinned),
+                    std::memory_order_release);
+  _instances[slot].exchange(replacement);
+  // the thread-local caches of the old service provider id are ignored
+  _id.store(detail::ThreadLocalServiceCache::nextProviderId(),
+            std::memory_order_release);
+  std::vector<CreatedInstance> previous;
+  if (auto* services = static_cast<std::vector<void*>*>(
+          _serviceSets[entryIndex].tryGet())) {
+    // the replaced singleton is the last non-transient service of its type
+    auto refreshed = std::make_unique<std::vector<void*>>(*services);
+    refreshed->back() = replacement;
+    _serviceSets[entryIndex].exchange(refreshed.release());
+    previous.push_back(CreatedInstance{
+        slot, services, &ScopedServiceProvider::deleteServiceSet});
+  }
+  const uint64_t epoch = _epoch.fetch_add(1, std::memory_order_seq_cst);
+
+  auto& versions = _replacements[slot];
+  if (!versions.empty()) {
+    previous.push_back(versions.back());
+    versions.pop_back();
+  } else if (_logIndexOfSlot[slot] != 0) {
+    // the log entry of the original instance releases the replacements
+    auto& logged = _initializationOrder.at(_logIndexOfSlot[slot] - 1);
+    previous.push_back(logged);
+    logged.destroy = nullptr;
+  }
+  // otherwise the instance is inherited from the parent, which owns it
+  const bool keep =
+      (pins & (currentInstancePinned | allInstancesPinned)) != 0 ||
+      _captured[slot];
+  _captured[slot] = false;
+  for (const auto& created : previous) {
+    if (keep)
+      versions.push_back(created);
+    else
+      _retired.push_back(RetiredInstance{created, epoch});
+  }
+  versions.push_back(CreatedInstance{slot, owner.release(), destroyOwner});
+  _numberOfRetired.store(_retired.size(), std::memory_order_seq_cst);
+  lock.unlock();
+  releaseRetired();
 }
 
 inline ServiceCollection::ServiceProvider::ScopedServiceProvider::
-    ScopedServiceProvider(ServiceProvider& parent)
-    : _parent(parent) {}
+    ScopedServiceProvider(ServiceProvider& parent, size_t poolIndex)
+    : _parent(parent),
+      _poolIndex(poolIndex),
+      _initializationOrder(parent._table->numberOfScopedSlots +
+                           parent._table->numberOfScopedSets),
+      _instances(std::make_unique<detail::OnceCell[]>(
+          parent._table->numberOfScopedSlots)),
+      _serviceSets(std::make_unique<detail::OnceCell[]>(
+          parent._table->numberOfScopedSets)) {
+  if (parent._scopeArenaSize != 0) _arena.emplace(parent._scopeArenaSize);
+  std::lock_guard lock{parent._replacementMutex};
+  parent._scopeEpochs.insert(&_epoch);
+}
 
 inline ServiceCollection::ServiceProvider::ScopedServiceProvider::
     ~ScopedServiceProvider() {
-  _instances.clear();
-  while (!_initializationOrder.empty()) _initializationOrder.pop_back();
+  clear();
+  std::lock_guard lock{_parent._replacementMutex};
+  _parent._scopeEpochs.erase(&_epoch);
+}
+
+inline void ServiceCollection::ServiceProvider::ScopedServiceProvider::
+operator delete(ScopedServiceProvider* scope, std::destroying_delete_t) {
+  if (scope->_poolIndex == detail::IndexFreeList::npos) {
+    scope->~ScopedServiceProvider();
+    ::operator delete(scope);
+    return;
+  }
+  scope->clear();
+  scope->_parent._freeScopes.push(scope->_poolIndex);
+}
+
+inline void ServiceCollection::ServiceProvider::ScopedServiceProvider::clear() {
+  _initializationOrder.popAll([this](const CreatedInstance& created) {
+    created.release();
+    const size_t numberOfSlots = table().numberOfSlots;
+    if (created.slot < numberOfSlots)
+      instanceOf(created.slot).reset();
+    else
+      _serviceSets[created.slot - numberOfSlots].reset();
+  });
+  if (_arena.has_value()) _arena->reset();
+  _epoch.store(0, std::memory_order_seq_cst);
+  if (_parent._numberOfRetired.load(std::memory_order_seq_cst) != 0)
+    _parent.releaseRetired();
 }
 
 inline std::any
 ServiceCollection::ServiceProvider::ScopedServiceProvider::getService(
     std::type_index type) {
-  auto factoryIt = _parent._factories.find(type);
-  if (factoryIt == _parent._factories.end()) return std::any();
-  const auto& desc = factoryIt->second.front();
-  return desc.type == ServiceType::Scoped
-             ? getService(*factoryIt, *this, *this,
-                          factoryIt->second.size() - 1)
-             : getService(*factoryIt, _parent, *this,
-                          factoryIt->second.size() - 1);
-  ;
+  const auto* entry = _parent._table->find(type);
+  if (entry == nullptr) return std::any();
+  return getService(entry, entry->descriptions.size() - 1);
 }
 
 inline std::vector<std::any>
 ServiceCollection::ServiceProvider::ScopedServiceProvider::getServices(
     std::type_index type) {
   std::vector<std::any> res;
-  auto factoryIt = _parent._factories.find(type);
-  if (factoryIt == _parent._factories.end()) return {};
-  for (size_t i = 0; i < factoryIt->second.size(); ++i) {
-    const auto& desc = factoryIt->second[i];
-    res.emplace_back(desc.type == ServiceType::Scoped
-                         ? getService(*factoryIt, *this, *this, i)
-                         : getService(*factoryIt, _parent, *this, i));
-  }
+  const auto* entry = _parent._table->find(type);
+  if (entry == nullptr) return res;
+  res.reserve(entry->descriptions.size());
+  for (size_t i = 0; i < entry->descriptions.size(); ++i)
+    res.emplace_back(getService(entry, i));
+  return res;
+}
+
+inline void*
+ServiceCollection::ServiceProvider::ScopedServiceProvider::getServiceById(
+    size_t typeId) {
+  return _parent.getServiceById(*this, typeId);
+}
+
+inline std::vector<void*>
+ServiceCollection::ServiceProvider::ScopedServiceProvider::getServicesById(
+    size_t typeId) {
+  std::vector<void*> res;
+  const auto* entry = _parent._table->find(typeId);
+  if (entry == nullptr) return res;
+  res.reserve(entry->descriptions.size());
+  for (size_t i = 0; i < entry->descriptions.size(); ++i)
+    if (entry->descriptions[i].type != ServiceType::Transient)
+      res.push_back(getInstance(*entry, i));
   return res;
 }
-}  // namespace CppInject
\ No newline at end of file
+
+inline std::span<void* const> ServiceCollection::ServiceProvider::
+    ScopedServiceProvider::getServiceSpanById(size_t typeId) {
+  const auto& table = *_parent._table;
+  const auto* entry = table.find(typeId);
+  if (entry == nullptr) return {};
+  const size_t setIndex =
+      table.scopedSetIndexOfEntry[entry - table.entries.data()];
+  // the instances are all singletons, which are kept alive by the epoch of
+  // the scope
+  if (setIndex == ~size_t{0}) return _parent.getServiceSet(*entry);
+  void* serviceSet = _serviceSets[setIndex].getOrInit([&]() -> void* {
+    auto* services = createServiceSet(*entry, *this);
+    // released by clear, with the scoped instances
+    _initializationOrder.push(CreatedInstance{table.numberOfSlots + setIndex,
+                                              services, &deleteServiceSet});
+    return services;
+  });
+  return *static_cast<std::vector<void*>*>(serviceSet);
+}
+
+inline std::shared_ptr<void> ServiceCollection::ServiceProvider::
+    ScopedServiceProvider::getTransientServiceById(size_t typeId) {
+  const auto* entry = _parent._table->find(typeId);
+  if (entry == nullptr ||
+      entry->descriptions.back().type != ServiceType::Transient)
+    return nullptr;
+  return createInstance(*entry, *this, entry->descriptions.size() - 1);
+}
+
+inline std::vector<std::shared_ptr<void>> ServiceCollection::ServiceProvider::
+    ScopedServiceProvider::getTransientServicesById(size_t typeId) {
+  std::vector<std::shared_ptr<void>> res;
+  const auto* entry = _parent._table->find(typeId);
+  if (entry == nullptr) return res;
+  res.reserve(entry->descriptions.size());
+  for (size_t i = 0; i < entry->descriptions.size(); ++i)
+    if (entry->descriptions[i].type == ServiceType::Transient)
+      res.push_back(createInstance(*entry, *this, i));
+  return res;
+}
+
+inline void* ServiceCollection::ServiceProvider::ScopedServiceProvider::
+    createUniqueServiceById(size_t typeId) {
+  const auto* entry = _parent._table->find(typeId);
+  if (entry == nullptr || entry->descriptions.back().createUnique == nullptr)
+    return nullptr;
+  return createUniqueInstance(*entry, *this, entry->descriptions.size() - 1);
+}
+
+inline void* ServiceCollection::ServiceProvider::ScopedServiceProvider::
+    getKeyedServiceById(size_t typeId, size_t keyId) {
+  const auto* entry = _parent._table->find(typeId);
+  if (entry == nullptr) return nullptr;
+  const size_t index = entry->indexOfKey(keyId);
+  if (index >= entry->descriptions.size() ||
+      entry->descriptions[index].type == ServiceType::Transient)
+    return nullptr;
+  return getInstance(*entry, index);
+}
+
+inline std::shared_ptr<void> ServiceCollection::ServiceProvider::
+    ScopedServiceProvider::getKeyedTransientServiceById(size_t typeId,
+                                                        size_t keyId) {
+  const auto* entry = _parent._table->find(typeId);
+  if (entry == nullptr) return nullptr;
+  const size_t index = entry->indexOfKey(keyId);
+  if (index >= entry->descriptions.size() ||
+      entry->descriptions[index].type != ServiceType::Transient)
+    return nullptr;
+  return createInstance(*entry, *this, index);
+}
+
+inline detail::PendingService ServiceCollection::ServiceProvider::
+    ScopedServiceProvider::getServiceAsyncById(size_t typeId) {
+  const auto* entry = _parent._table->find(typeId);
+  if (entry != nullptr && entry->descriptions.back().createAsync != nullptr)
+    return _parent.getServiceAsyncById(typeId);
+  return {nullptr, getServiceById(typeId)};
+}
+
+inline void
+ServiceCollection::ServiceProvider::ScopedServiceProvider::resolveByIds(
+    std::span<const size_t> typeIds, std::span<void*> services) {
+  const auto& table = this->table();
+  for (size_t i = 0; i < typeIds.size(); ++i) {
+    const auto* dependency = table.lastImplementationOf(typeIds[i]);
+    if (dependency == nullptr) {
+      services[i] = nullptr;
+      continue;
+    }
+    // instrumented builds count every resolution
+#ifndef CPPINJECT_INSTRUMENTATION
+    const size_t slot = table.slotOf(*dependency);
+    detail::OnceCell& cell = table.scopedIndexOfSlot[slot] != ~size_t{0}
+                                 ? instanceOf(slot)
+                                 : _parent.instanceOf(slot);
+    if (void* service = cell.tryGet()) {
+      services[i] = service;
+      continue;
+    }
+#endif
+    services[i] = getInstance(*dependency->entry, dependency->index);
+  }
+}
+
+inline size_t
+ServiceCollection::ServiceProvider::ScopedServiceProvider::memoryUsage() const {
+  const auto& table = *_parent._table;
+  // the log holds the scoped instances and the service sets of the scope
+  size_t bytes =
+      sizeof(ScopedServiceProvider) +
+      table.numberOfScopedSlots *
+          (sizeof(CreatedInstance) + sizeof(detail::OnceCell)) +
+      table.numberOfScopedSets * sizeof(CreatedInstance) +
+      serviceSetsMemoryUsage(_serviceSets.get(), table.numberOfScopedSets);
+  if (_arena.has_value()) bytes += _arena->capacity();
+  return bytes;
+}
+
+inline detail::ResolverSlot
+ServiceCollection::ServiceProvider::ScopedServiceProvider::getResolverById(
+    size_t typeId) {
+  const auto* dependency = table().lastImplementationOf(typeId);
+  if (dependency == nullptr) return {};
+  // singletons are resolved by the root service provider
+  if (dependency->entry->descriptions[dependency->index].type !=
+      ServiceType::Scoped)
+    return _parent.getResolverById(typeId);
+  return {&instanceOf(table().slotOf(*dependency)), this, dependency,
+          &CreationContext::getServiceInScope};
+}
+
+inline size_t
+ServiceCollection::ServiceProvider::ScopedServiceProvider::getServiceTypeId(
+    std::type_index type) {
+  return _parent.getServiceTypeId(type);
+}
+
+inline size_t
+ServiceCollection::ServiceProvider::ScopedServiceProvider::getKeyId(
+    std::string_view name) {
+  return _parent.getKeyId(name);
+}
+
+inline void*
+ServiceCollection::ServiceProvider::ScopedServiceProvider::getInstance(
+    const ServiceTable::Entry& entry, size_t index) {
+  return entry.descriptions[index].type == ServiceType::Scoped
+             ? getInstance(entry, *this, index)
+             : getInstance(entry, _parent, index);
+}
+
+inline ServiceCollection::CreationContext
+ServiceCollection::ServiceProvider::ScopedServiceProvider::creationContext(
+    size_t slot) {
+  return CreationContext{*this, arena(), _parent._table->planOf(slot),
+                         _parent, this, slot};
+}
+
+inline std::any
+ServiceCollection::ServiceProvider::ScopedServiceProvider::getService(
+    const ServiceTable::Entry* entry, size_t index) {
+  const auto& desc = entry->descriptions[index];
+  if (desc.type == ServiceType::Transient)
+    return desc.box(createInstance(*entry, *this, index));
+  return desc.box(std::shared_ptr<void>(std::shared_ptr<void>{},
+                                        getInstance(*entry, index)));
+}
+
+inline void* ServiceCollection::CreationContext::getService(
+    const ServiceTable::Dependency& dependency) const {
+  if (scope != nullptr)
+    return scope->getInstance(*dependency.entry, dependency.index);
+  return root.getInstance(*dependency.entry, dependency.index);
+}
+
+inline std::shared_ptr<void>
+ServiceCollection::CreationContext::getTransientService(
+    const ServiceTable::Dependency& dependency) const {
+  if (scope != nullptr)
+    return ServiceProvider::ScopedServiceProvider::createInstance(
+        *dependency.entry, *scope, dependency.index);
+  return ServiceProvider::ScopedServiceProvider::createInstance(
+      *dependency.entry, root, dependency.index);
+}
+
+inline void* ServiceCollection::CreationContext::getUniqueService(
+    const ServiceTable::Dependency& dependency) const {
+  if (scope != nullptr)
+    return ServiceProvider::ScopedServiceProvider::createUniqueInstance(
+        *dependency.entry, *scope, dependency.index);
+  return ServiceProvider::ScopedServiceProvider::createUniqueInstance(
+      *dependency.entry, root, dependency.index);
+}
+inline void* ServiceCollection::CreationContext::getServiceInRoot(
+    IServiceProvider& serviceProvider, const void* dependency) {
+  const auto& planned =
+      *static_cast<const ServiceTable::Dependency*>(dependency);
+  return static_cast<ServiceProvider&>(serviceProvider)
+      .getInstance(*planned.entry, planned.index);
+}
+
+inline void* ServiceCollection::CreationContext::getServiceInScope(
+    IServiceProvider& serviceProvider, const void* dependency) {
+  const auto& planned =
+      *static_cast<const ServiceTable::Dependency*>(dependency);
+  return static_cast<ServiceProvider::ScopedServiceProvider&>(serviceProvider)
+      .getInstance(*planned.entry, planned.index);
+}
+
+inline std::shared_ptr<void>
+ServiceCollection::CreationContext::getTransientServiceInRoot(
+    IServiceProvider& serviceProvider, const void* dependency) {
+  const auto& planned =
+      *static_cast<const ServiceTable::Dependency*>(dependency);
+  return ServiceProvider::ScopedServiceProvider::createInstance(
+      *planned.entry, static_cast<ServiceProvider&>(serviceProvider),
+      planned.index);
+}
+
+inline std::shared_ptr<void>
+ServiceCollection::CreationContext::getTransientServiceInScope(
+    IServiceProvider& serviceProvider, const void* dependency) {
+  const auto& planned =
+      *static_cast<const ServiceTable::Dependency*>(dependency);
+  return ServiceProvider::ScopedServiceProvider::createInstance(
+      *planned.entry,
+      static_cast<ServiceProvider::ScopedServiceProvider&>(serviceProvider),
+      planned.index);
+}
+}  // namespace CppInject
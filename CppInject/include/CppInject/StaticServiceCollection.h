@@ -0,0 +1,562 @@
+#pragma once
+
+#include <algorithm>
+#include <any>
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <typeindex>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "ConstructorFinder.h"
+#include "IServiceProvider.h"
+#include "TypeTraits.h"
+
+namespace CppInject {
+
+/// <summary>
+/// Registers a singleton service of a StaticServiceCollection
+/// </summary>
+/// <typeparam name="TService">The type of the service</typeparam>
+/// <typeparam name="TImplementation">The type of the implementation -
+/// TService must be a base of TImplementation</typeparam>
+template <class TService, class TImplementation = TService>
+struct SingletonRegistration {
+  static_assert(std::is_base_of_v<TService, TImplementation>,
+                "TService must be a base of TImplementation");
+  using Service = TService;
+  using Implementation = TImplementation;
+  static constexpr bool isSingleton = true;
+};
+
+/// <summary>
+/// Registers a transient service of a StaticServiceCollection
+/// </summary>
+/// <typeparam name="TService">The type of the service</typeparam>
+/// <typeparam name="TImplementation">The type of the implementation -
+/// TService must be a base of TImplementation</typeparam>
+template <class TService, class TImplementation = TService>
+struct TransientRegistration {
+  static_assert(std::is_base_of_v<TService, TImplementation>,
+                "TService must be a base of TImplementation");
+  using Service = TService;
+  using Implementation = TImplementation;
+  static constexpr bool isSingleton = false;
+};
+
+/// <summary>
+/// A service provider whose registrations are resolved at compile time.
+/// <para/>
+/// The singletons are members of the service provider. They are created by
+/// the constructor in dependency order and destroyed in reverse order, so
+/// get is a plain member access. Missing and circular dependencies are
+/// compile errors.
+/// <para/>
+/// Constructor arguments can be references to singletons, shared_ptrs to
+/// transient services and IServiceProvider references, other kinds of
+/// arguments are compile errors that name the kind. If a service is
+/// registered multiple times, the last registration is used. The service
+/// provider implements IServiceProviderRoot for code that needs the dynamic
+/// interface. It has no scoped services, its scopes forward to the service
+/// provider.
+/// </summary>
+/// <typeparam name="Registrations">SingletonRegistrations and
+/// TransientRegistrations</typeparam>
+template <class... Registrations>
+class StaticServiceProvider final : public IServiceProviderRoot {
+  static constexpr size_t npos = ~size_t{0};
+  static constexpr size_t numberOfRegistrations = sizeof...(Registrations);
+
+  template <size_t I>
+  using RegistrationAt = std::tuple_element_t<I, std::tuple<Registrations...>>;
+
+  template <class TRegistration>
+  using Storage =
+      std::conditional_t<TRegistration::isSingleton,
+                         std::optional<typename TRegistration::Implementation>,
+                         std::monostate>;
+
+  template <class TRegistration>
+  using Arguments =
+      ConstructorArgsAsTuple<typename TRegistration::Implementation>;
+
+  // The index of the last registration of TService, npos if there is none
+  template <class TService, bool isSingleton>
+  static constexpr size_t indexOf() {
+    constexpr bool matches[] = {
+        false, (std::is_same_v<typename Registrations::Service, TService> &&
+                Registrations::isSingleton == isSingleton)...};
+    size_t index = npos;
+    for (size_t i = 1; i < std::size(matches); ++i)
+      if (matches[i]) index = i - 1;
+    return index;
+  }
+
+  template <class TArgument>
+  static constexpr size_t dependencyIndex() {
+    if constexpr (std::is_same_v<IServiceProvider, TArgument> ||
+                  TypeTraits::IsVector<TArgument>::value)
+      return npos;
+    else if constexpr (TypeTraits::IsSharedPointer<TArgument>::value)
+      return indexOf<std::remove_cv_t<typename TArgument::element_type>,
+                     false>();
+    else
+      return indexOf<TArgument, true>();
+  }
+
+  static constexpr size_t maxDependencies =
+      std::max({size_t{0}, std::tuple_size_v<Arguments<Registrations>>...});
+  // One extra element, so that the arrays are never empty
+  using Dependencies = std::array<size_t, maxDependencies + 1>;
+
+  template <class TRegistration, size_t... I>
+  static constexpr Dependencies dependenciesOf(std::index_sequence<I...>) {
+    Dependencies dependencies{};
+    dependencies.fill(npos);
+    ((dependencies[I] = dependencyIndex<
+          std::tuple_element_t<I, Arguments<TRegistration>>>()),
+     ...);
+    return dependencies;
+  }
+
+  static constexpr std::array<Dependencies, numberOfRegistrations + 1>
+      dependencies{dependenciesOf<Registrations>(
+          std::make_index_sequence<
+              std::tuple_size_v<Arguments<Registrations>>>{})...};
+
+  using VisitStates = std::array<char, numberOfRegistrations + 1>;
+
+  struct CreationOrder {
+    std::array<size_t, numberOfRegistrations + 1> order{};
+    size_t size = 0;
+    bool hasCycle = false;
+  };
+
+  static constexpr bool visit(size_t index, VisitStates& states,
+                              CreationOrder& creationOrder) {
+    if (states[index] == 2) return true;
+    if (states[index] == 1) return false;
+    states[index] = 1;
+    for (size_t dependency : dependencies[index])
+      if (dependency != npos && !visit(dependency, states, creationOrder))
+        return false;
+    states[index] = 2;
+    creationOrder.order[creationOrder.size++] = index;
+    return true;
+  }
+
+  // Every registration comes after the registrations it depends on
+  static constexpr CreationOrder sortTopologically() {
+    CreationOrder creationOrder{};
+    VisitStates states{};
+    for (size_t i = 0; i < numberOfRegistrations; ++i)
+      if (!visit(i, states, creationOrder)) creationOrder.hasCycle = true;
+    return creationOrder;
+  }
+
+  static constexpr CreationOrder creationOrder = sortTopologically();
+  static_assert(!creationOrder.hasCycle,
+                "The registrations have circular dependencies.");
+
+  // A registration as seen through the dynamic interface
+  struct Slot {
+    std::type_index type;
+    size_t typeId;
+    bool isSingleton;
+    void* service;
+    std::shared_ptr<void> (*create)(StaticServiceProvider& serviceProvider);
+    std::any (*box)(std::shared_ptr<void> service);
+  };
+
+  struct ServiceSet {
+    size_t typeId;
+    std::vector<void*> services;
+  };
+
+  class Scope final : public IServiceProvider {
+    StaticServiceProvider& _parent;
+
+   public:
+    explicit Scope(StaticServiceProvider& parent) : _parent(parent) {}
+
+    std::any getService(std::type_index type) final {
+      return _parent.getService(type);
+    }
+    std::vector<std::any> getServices(std::type_index type) final {
+      return _parent.getServices(type);
+    }
+    void* getServiceById(size_t typeId) final {
+      return _parent.getServiceById(typeId);
+    }
+    std::vector<void*> getServicesById(size_t typeId) final {
+      return _parent.getServicesById(typeId);
+    }
+    std::span<void* const> getServiceSpanById(size_t typeId) final {
+      return _parent.getServiceSpanById(typeId);
+    }
+    std::shared_ptr<void> getTransientServiceById(size_t typeId) final {
+      return _parent.getTransientServiceById(typeId);
+    }
+    std::vector<std::shared_ptr<void>> getTransientServicesById(
+        size_t typeId) final {
+      return _parent.getTransientServicesById(typeId);
+    }
+    void* createUniqueServiceById(size_t typeId) final {
+      return _parent.createUniqueServiceById(typeId);
+    }
+    void* getKeyedServiceById(size_t typeId, size_t keyId) final {
+      return _parent.getKeyedServiceById(typeId, keyId);
+    }
+    std::shared_ptr<void> getKeyedTransientServiceById(size_t typeId,
+                                                       size_t keyId) final {
+      return _parent.getKeyedTransientServiceById(typeId, keyId);
+    }
+    detail::PendingService getServiceAsyncById(size_t typeId) final {
+      return _parent.getServiceAsyncById(typeId);
+    }
+    void resolveByIds(std::span<const size_t> typeIds,
+                      std::span<void*> services) final {
+      _parent.resolveByIds(typeIds, services);
+    }
+    size_t memoryUsage() const final { return sizeof(Scope); }
+    detail::ResolverSlot getResolverById(size_t typeId) final {
+      return _parent.getResolverById(typeId);
+    }
+    size_t getServiceTypeId(std::type_index type) final {
+      return _parent.getServiceTypeId(type);
+    }
+    size_t getKeyId(std::string_view name) final {
+      return _parent.getKeyId(name);
+    }
+  };
+
+  std::tuple<Storage<Registrations>...> _singletons;
+  std::vector<Slot> _slots;
+  std::vector<ServiceSet> _serviceSets;
+  // The singleton of each slot for Resolvers, initialized by the constructor
+  std::unique_ptr<detail::OnceCell[]> _cells =
+      std::make_unique<detail::OnceCell[]>(numberOfRegistrations);
+
+  // The dependency of a Resolver is the singleton itself
+  static void* resolveSingleton(IServiceProvider&, const void* service) {
+    return const_cast<void*>(service);
+  }
+
+  // Arguments that only the dynamic service provider can inject
+  template <class TArgument>
+  static constexpr bool isUnsupported =
+      TypeTraits::IsVector<TArgument>::value ||
+      TypeTraits::IsServiceSpan<TArgument>::value ||
+      TypeTraits::IsUniquePointer<TArgument>::value ||
+      TypeTraits::IsLazy<TArgument>::value ||
+      TypeTraits::IsFactory<TArgument>::value;
+
+  template <class TArgument>
+  decltype(auto) resolve() {
+    static_assert(!TypeTraits::IsVector<TArgument>::value,
+                  "A StaticServiceProvider cannot inject vectors.");
+    static_assert(!TypeTraits::IsServiceSpan<TArgument>::value,
+                  "A StaticServiceProvider cannot inject ServiceSpans.");
+    static_assert(!TypeTraits::IsUniquePointer<TArgument>::value,
+                  "A StaticServiceProvider cannot inject unique_ptrs.");
+    static_assert(!TypeTraits::IsLazy<TArgument>::value,
+                  "A StaticServiceProvider cannot inject Lazy dependencies.");
+    static_assert(!TypeTraits::IsFactory<TArgument>::value,
+                  "A StaticServiceProvider cannot inject Factories.");
+    static_assert(isUnsupported<TArgument> ||
+                      std::is_same_v<IServiceProvider, TArgument> ||
+                      dependencyIndex<TArgument>() != npos,
+                  "A constructor argument has not been registered.");
+    if constexpr (std::is_same_v<IServiceProvider, TArgument>)
+      return static_cast<IServiceProvider&>(*this);
+    else if constexpr (TypeTraits::IsSharedPointer<TArgument>::value)
+      return create<std::remove_cv_t<typename TArgument::element_type>>();
+    else
+      return get<TArgument>();
+  }
+
+  template <class TRegistration, size_t... I>
+  std::shared_ptr<typename TRegistration::Implementation> createTransient(
+      std::index_sequence<I...>) {
+    return std::make_shared<typename TRegistration::Implementation>(
+        resolve<std::tuple_element_t<I, Arguments<TRegistration>>>()...);
+  }
+
+  template <size_t I>
+  void construct() {
+    using Registration = RegistrationAt<I>;
+    if constexpr (Registration::isSingleton) {
+      constexpr size_t numberOfArguments =
+          std::tuple_size_v<Arguments<Registration>>;
+      constructSingleton<I>(std::make_index_sequence<numberOfArguments>{});
+    }
+  }
+
+  template <size_t I, size_t... A>
+  void constructSingleton(std::index_sequence<A...>) {
+    using Args = Arguments<RegistrationAt<I>>;
+    std::get<I>(_singletons)
+        .emplace(resolve<std::tuple_element_t<A, Args>>()...);
+  }
+
+  template <size_t... K>
+  void constructAll(std::index_sequence<K...>) {
+    (construct<creationOrder.order[K]>(), ...);
+  }
+
+  template <size_t... K>
+  void destroyAll(std::index_sequence<K...>) {
+    (destroy<creationOrder.order[numberOfRegistrations - 1 - K]>(), ...);
+  }
+
+  template <size_t I>
+  void destroy() {
+    if constexpr (RegistrationAt<I>::isSingleton)
+      std::get<I>(_singletons).reset();
+  }
+
+  template <size_t I>
+  static std::shared_ptr<void> createSlotInstance(
+      StaticServiceProvider& serviceProvider) {
+    using Registration = RegistrationAt<I>;
+    constexpr size_t numberOfArguments =
+        std::tuple_size_v<Arguments<Registration>>;
+    return std::static_pointer_cast<typename Registration::Service>(
+        serviceProvider.createTransient<Registration>(
+            std::make_index_sequence<numberOfArguments>{}));
+  }
+
+  template <size_t I>
+  void addSlot() {
+    using Registration = RegistrationAt<I>;
+    using Service = typename Registration::Service;
+    if constexpr (Registration::isSingleton) {
+      void* service = static_cast<Service*>(&*std::get<I>(_singletons));
+      _slots.push_back(Slot{std::type_index(typeid(Service)),
+                            detail::getServiceTypeId<Service>(), true,
+                            service, nullptr,
+                            [](std::shared_ptr<void> service) -> std::any {
+                              return std::ref(
+                                  *static_cast<Service*>(service.get()));
+                            }});
+      _cells[I].getOrInitUnsynchronized([service] { return service; });
+      const size_t typeId = _slots.back().typeId;
+      auto set = std::find_if(
+          _serviceSets.begin(), _serviceSets.end(),
+          [typeId](const ServiceSet& s) { return s.typeId == typeId; });
+      if (set == _serviceSets.end())
+        set = _serviceSets.insert(set, ServiceSet{typeId, {}});
+      set->services.push_back(service);
+    } else {
+      _slots.push_back(
+          Slot{std::type_index(typeid(std::shared_ptr<Service>)),
+               detail::getServiceTypeId<std::shared_ptr<Service>>(), false,
+               nullptr, &createSlotInstance<I>,
+               [](std::shared_ptr<void> service) -> std::any {
+                 return std::static_pointer_cast<Service>(std::move(service));
+               }});
+    }
+  }
+
+  template <size_t... I>
+  void addSlots(std::index_sequence<I...>) {
+    _slots.reserve(numberOfRegistrations);
+    (addSlot<I>(), ...);
+  }
+
+  std::any box(const Slot& slot) {
+    if (!slot.isSingleton) return slot.box(slot.create(*this));
+    return slot.box(
+        std::shared_ptr<void>(std::shared_ptr<void>{}, slot.service));
+  }
+
+ public:
+  StaticServiceProvider() {
+    try {
+      constructAll(std::make_index_sequence<numberOfRegistrations>{});
+    } catch (...) {
+      destroyAll(std::make_index_sequence<numberOfRegistrations>{});
+      throw;
+    }
+    addSlots(std::make_index_sequence<numberOfRegistrations>{});
+  }
+  StaticServiceProvider(const StaticServiceProvider&) = delete;
+  StaticServiceProvider& operator=(const StaticServiceProvider&) = delete;
+  ~StaticServiceProvider() {
+    destroyAll(std::make_index_sequence<numberOfRegistrations>{});
+  }
+
+  /// <summary>
+  /// Get a singleton service. Fails to compile if the service has not been
+  /// registered as a singleton.
+  /// </summary>
+  /// <typeparam name="TService">The type of the requested service</typeparam>
+  /// <returns>A reference to the service</returns>
+  template <class TService>
+  TService& get() {
+    constexpr size_t index = indexOf<std::remove_cv_t<TService>, true>();
+    static_assert(index != npos,
+                  "TService has not been registered as a singleton.");
+    return *std::get<index>(_singletons);
+  }
+
+  /// <summary>
+  /// Create a transient service. Fails to compile if the service has not
+  /// been registered as a transient service.
+  /// </summary>
+  /// <typeparam name="TService">The type of the requested service</typeparam>
+  /// <returns>A shared_ptr to the new service</returns>
+  template <class TService>
+  std::shared_ptr<TService> create() {
+    constexpr size_t index = indexOf<std::remove_cv_t<TService>, false>();
+    static_assert(index != npos,
+                  "TService has not been registered as a transient service.");
+    using Registration = RegistrationAt<index>;
+    constexpr size_t numberOfArguments =
+        std::tuple_size_v<Arguments<Registration>>;
+    return createTransient<Registration>(
+        std::make_index_sequence<numberOfArguments>{});
+  }
+
+  std::any getService(std::type_index type) final {
+    for (size_t i = _slots.size(); i-- > 0;)
+      if (_slots[i].type == type) return box(_slots[i]);
+    return std::any();
+  }
+
+  std::vector<std::any> getServices(std::type_index type) final {
+    std::vector<std::any> res;
+    for (auto& slot : _slots)
+      if (slot.type == type) res.push_back(box(slot));
+    return res;
+  }
+
+  void* getServiceById(size_t typeId) final {
+    for (size_t i = _slots.size(); i-- > 0;)
+      if (_slots[i].typeId == typeId)
+        return _slots[i].isSingleton ? _slots[i].service : nullptr;
+    return nullptr;
+  }
+
+  std::vector<void*> getServicesById(size_t typeId) final {
+    auto services = getServiceSpanById(typeId);
+    return std::vector<void*>(services.begin(), services.end());
+  }
+
+  std::span<void* const> getServiceSpanById(size_t typeId) final {
+    for (const auto& set : _serviceSets)
+      if (set.typeId == typeId) return set.services;
+    return {};
+  }
+
+  std::shared_ptr<void> getTransientServiceById(size_t typeId) final {
+    for (size_t i = _slots.size(); i-- > 0;)
+      if (_slots[i].typeId == typeId)
+        return _slots[i].isSingleton ? nullptr : _slots[i].create(*this);
+    return nullptr;
+  }
+
+  std::vector<std::shared_ptr<void>> getTransientServicesById(
+      size_t typeId) final {
+    std::vector<std::shared_ptr<void>> res;
+    for (auto& slot : _slots)
+      if (slot.typeId == typeId && !slot.isSingleton)
+        res.push_back(slot.create(*this));
+    return res;
+  }
+
+  // There are no unique transient or keyed registrations
+  void* createUniqueServiceById(size_t) final { return nullptr; }
+  void* getKeyedServiceById(size_t, size_t) final { return nullptr; }
+  std::shared_ptr<void> getKeyedTransientServiceById(size_t, size_t) final {
+    return nullptr;
+  }
+  // All singletons are created by build
+  detail::PendingService getServiceAsyncById(size_t typeId) final {
+    return {nullptr, getServiceById(typeId)};
+  }
+  void resolveByIds(std::span<const size_t> typeIds,
+                    std::span<void*> services) final {
+    for (size_t i = 0; i < typeIds.size(); ++i)
+      services[i] = getServiceById(typeIds[i]);
+  }
+  size_t getServiceTypeId(std::type_index type) final {
+    for (size_t i = _slots.size(); i-- > 0;)
+      if (_slots[i].type == type) return _slots[i].typeId;
+    return 0;
+  }
+  size_t getKeyId(std::string_view) final { return 0; }
+  // The singletons are stored in the service provider
+  size_t memoryUsage() const final {
+    size_t bytes = sizeof(StaticServiceProvider) +
+                   _slots.capacity() * sizeof(Slot) +
+                   _serviceSets.capacity() * sizeof(ServiceSet) +
+                   numberOfRegistrations * sizeof(detail::OnceCell);
+    for (const auto& set : _serviceSets)
+      bytes += set.services.capacity() * sizeof(void*);
+    return bytes;
+  }
+  detail::ResolverSlot getResolverById(size_t typeId) final {
+    for (size_t i = _slots.size(); i-- > 0;)
+      if (_slots[i].typeId == typeId)
+        return _slots[i].isSingleton
+                   ? detail::ResolverSlot{&_cells[i], this, _slots[i].service,
+                                          &resolveSingleton}
+                   : detail::ResolverSlot{};
+    return {};
+  }
+
+  std::unique_ptr<IServiceProvider> createScope() final {
+    return std::make_unique<Scope>(*this);
+  }
+  // Scopes only forward to the singletons
+  std::unique_ptr<IServiceProvider> createScope(ScopeMode) final {
+    return createScope();
+  }
+
+  // All singletons are created by the constructor
+  void warmUp(size_t) final {}
+  std::unique_ptr<IServiceProviderRoot> createChild(
+      const ServiceCollection&) final {
+    throw std::logic_error(
+        "A StaticServiceProvider cannot create child service providers.");
+  }
+  // get returns references that are resolved at compile time
+  void replaceSingletonById(size_t, std::shared_ptr<void>) final {
+    throw std::logic_error(
+        "A StaticServiceProvider cannot replace singletons.");
+  }
+
+#ifdef CPPINJECT_INSTRUMENTATION
+  // Resolving through get and create is not instrumented
+  std::vector<ServiceStatistics> statistics() const final { return {}; }
+#endif
+};
+
+/// <summary>
+/// A collection of services that is resolved at compile time - see
+/// StaticServiceProvider.
+/// </summary>
+/// <typeparam name="Registrations">SingletonRegistrations and
+/// TransientRegistrations</typeparam>
+template <class... Registrations>
+struct StaticServiceCollection {
+  using ServiceProvider = StaticServiceProvider<Registrations...>;
+
+  /// <summary>
+  /// Create a service provider, which creates all singletons
+  /// </summary>
+  /// <returns>A unique_ptr to the service provider instance</returns>
+  static std::unique_ptr<ServiceProvider> build() {
+    return std::make_unique<ServiceProvider>();
+  }
+};
+}  // namespace CppInject
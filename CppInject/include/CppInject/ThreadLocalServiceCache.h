@@ -0,0 +1,77 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace CppInject::detail {
+
+/// <summary>
+/// A per-thread cache of the singleton services of the service provider that
+/// the thread used last, indexed by the service type id.
+/// <para/>
+/// Every service provider has a unique id that is never reused. The cache is
+/// only read for the id it was filled for, so the entries of a destroyed
+/// service provider are never returned, even though they are only replaced
+/// when the thread uses another service provider.
+/// <para/>
+/// Entries can be marked when they are inserted, so a service provider can
+/// tell the services it has prepared for its own lookups from the services
+/// that its scopes cached.
+/// </summary>
+class ThreadLocalServiceCache {
+  struct Entry {
+    void* service = nullptr;
+    bool marked = false;
+  };
+  uint64_t _providerId = 0;
+  std::vector<Entry> _services;
+
+  inline static ThreadLocalServiceCache& current() {
+    thread_local ThreadLocalServiceCache cache;
+    return cache;
+  }
+
+ public:
+  /// <summary>
+  /// Get a new service provider id. Ids start at 1.
+  /// </summary>
+  inline static uint64_t nextProviderId() {
+    static std::atomic<uint64_t> lastId{0};
+    return lastId.fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+
+  /// <summary>
+  /// Get a cached service of the current thread
+  /// </summary>
+  /// <param name="markedOnly">Whether services that were inserted without a
+  /// mark are ignored</param>
+  /// <returns>The service, or a nullptr if it has not been cached</returns>
+  inline static void* find(uint64_t providerId, size_t typeId,
+                           bool markedOnly = false) {
+    const auto& cache = current();
+    if (cache._providerId != providerId || typeId >= cache._services.size())
+      return nullptr;
+    const Entry& entry = cache._services[typeId];
+    return markedOnly && !entry.marked ? nullptr : entry.service;
+  }
+
+  /// <summary>
+  /// Cache a service for the current thread, replacing the services of any
+  /// other service provider.
+  /// </summary>
+  inline static void insert(uint64_t providerId, size_t typeId, void* service,
+                            bool marked = false) {
+    auto& cache = current();
+    if (cache._providerId != providerId) {
+      cache._providerId = providerId;
+      std::fill(cache._services.begin(), cache._services.end(), Entry{});
+    }
+    if (typeId >= cache._services.size())
+      cache._services.resize(typeId + 1);
+    cache._services[typeId] = Entry{service, marked};
+  }
+};
+}  // namespace CppInject::detail
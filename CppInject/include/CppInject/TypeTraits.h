@@ -2,8 +2,18 @@
 
 #include <memory>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
+namespace CppInject {
+template <class TService>
+class ServiceSpan;
+template <class TService>
+class Lazy;
+template <class TService>
+class Factory;
+}
+
 namespace CppInject::TypeTraits {
 template <typename T, typename Enable = void>
 struct IsSharedPointer : std::false_type {};
@@ -15,6 +25,12 @@ struct IsSharedPointer<
            std::shared_ptr<typename std::decay_t<T>::element_type>>>>
     : std::true_type {};
 
+template <typename T>
+struct IsUniquePointer : std::false_type {};
+
+template <typename T>
+struct IsUniquePointer<std::unique_ptr<T>> : std::true_type {};
+
 template <typename T, typename Enable = void>
 struct IsVector : std::false_type {};
 
@@ -24,4 +40,29 @@ struct IsVector<T, typename std::enable_if_t<std::is_same<
                        std::vector<typename T::value_type,
                                    typename T::allocator_type>>::value>>
     : std::true_type {};
+
+template <typename T>
+struct IsServiceSpan : std::false_type {};
+
+template <typename T>
+struct IsServiceSpan<ServiceSpan<T>> : std::true_type {};
+
+template <typename T>
+struct IsLazy : std::false_type {};
+
+template <typename T>
+struct IsLazy<Lazy<T>> : std::true_type {};
+
+template <typename T>
+struct IsFactory : std::false_type {};
+
+template <typename T>
+struct IsFactory<Factory<T>> : std::true_type {};
+
+template <typename T, typename Enable = void>
+struct HasReset : std::false_type {};
+
+template <typename T>
+struct HasReset<T, std::void_t<decltype(std::declval<T&>().reset())>>
+    : std::true_type {};
 }  // namespace CppInject::TypeTraits
@@ -1,6 +1,8 @@
 #include <CppInject/ServiceCollection.h>
+#include <CppInject/StaticServiceCollection.h>
 
 #include <bitset>
+#include <future>
 
 using namespace CppInject;
 
@@ -349,6 +351,24 @@ TEST(ServiceProviderTest, DestructsSingletonServicesInReversedCreationOrder) {
   ASSERT_FALSE(failure);
 }
 
+TEST(ServiceProviderTest, DestructsWarmedUpSingletonsInReversedCreationOrder) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<DestructorTestClass3>();
+  serviceCollection.addSingleton<DestructorTestClass2>();
+  serviceCollection.addSingleton<DestructorTestClass1>();
+  serviceCollection.addSingleton<DestructorTestClass0>();
+  bool failure = false;
+  {
+    auto serviceProvider = serviceCollection.build();
+    serviceProvider->warmUp(4);
+    auto* service = serviceProvider->getService<DestructorTestClass0>();
+    ASSERT_NE(nullptr, service);
+    ASSERT_TRUE(service->_value.none());
+    service->_failure = &failure;
+  }
+  ASSERT_FALSE(failure);
+}
+
 TEST(ServiceProviderTest, DestructsScopedServicesInReversedCreationOrder) {
   ServiceCollection serviceCollection;
   serviceCollection.addScoped<DestructorTestClass0>();
@@ -364,10 +384,190 @@ TEST(ServiceProviderTest, DestructsScopedServicesInReversedCreationOrder) {
   ASSERT_FALSE(failure);
 }
 
+struct FactoryCreatedService {
+  int* destructions;
+  explicit FactoryCreatedService(int* destructions)
+      : destructions(destructions) {}
+  ~FactoryCreatedService() { ++*destructions; }
+};
+
+struct ScopedFactoryCreatedService : FactoryCreatedService {
+  using FactoryCreatedService::FactoryCreatedService;
+};
+
+TEST(ServiceProviderTest, DestructsFactoryCreatedServicesOnce) {
+  int destructions = 0;
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<FactoryCreatedService>(
+      [&destructions](IServiceProvider&) {
+        return std::make_unique<FactoryCreatedService>(&destructions);
+      });
+  serviceCollection.addScoped<ScopedFactoryCreatedService>(
+      [&destructions](IServiceProvider&) {
+        return std::make_shared<ScopedFactoryCreatedService>(&destructions);
+      });
+  {
+    auto serviceProvider = serviceCollection.build();
+    auto scope = serviceProvider->createScope();
+    ASSERT_NE(nullptr, serviceProvider->getService<FactoryCreatedService>());
+    ASSERT_NE(nullptr, scope->getService<ScopedFactoryCreatedService>());
+    scope.reset();
+    ASSERT_EQ(1, destructions);
+  }
+  ASSERT_EQ(2, destructions);
+}
+
+TEST(ServiceProviderTest, SingleThreadedScopesProvideScopedServices) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<DestructorTestClass0>();
+  serviceCollection.addScoped<DestructorTestClass1>();
+  serviceCollection.addScoped<DestructorTestClass2>();
+  serviceCollection.addScoped<DestructorTestClass3>();
+  bool failure = false;
+  auto serviceProvider = serviceCollection.build();
+  auto& singleton = serviceProvider->getRequiredService<DestructorTestClass0>();
+  singleton._failure = &failure;
+  for (int i = 0; i < 2; ++i) {
+    {
+      auto scope = serviceProvider->createScope(ScopeMode::SingleThreaded);
+      auto& service = scope->getRequiredService<DestructorTestClass3>();
+      ASSERT_EQ(&service, scope->getService<DestructorTestClass3>());
+      ASSERT_EQ(&singleton, &service._dependency._dependency._dependency);
+    }
+    // the scoped services have been destroyed in reversed creation order
+    ASSERT_EQ(0b1110u, singleton._value.to_ulong());
+    singleton._value.reset();
+  }
+  ASSERT_FALSE(failure);
+  singleton._value.set();
+}
+
+struct SelfRequestingService {};
+
+TEST(ServiceProviderTest, SingleThreadedScopesDetectCircularDependencies) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addScoped<SelfRequestingService>([](IServiceProvider& sp) {
+    sp.getRequiredService<SelfRequestingService>();
+    return std::make_unique<SelfRequestingService>();
+  });
+  auto serviceProvider = serviceCollection.build();
+  auto scope = serviceProvider->createScope(ScopeMode::SingleThreaded);
+  ASSERT_THROW(scope->getService<SelfRequestingService>(), std::logic_error);
+  // the failed creation has reset the instance
+  ASSERT_THROW(scope->getService<SelfRequestingService>(), std::logic_error);
+}
+
+TEST(ServiceProviderTest, ReusesPooledScopes) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addScoped<DestructorTestClass0>();
+  serviceCollection.addScoped<DestructorTestClass1>();
+  serviceCollection.addScoped<DestructorTestClass2>();
+  serviceCollection.addScoped<DestructorTestClass3>();
+  ServiceProviderOptions options;
+  options.scopePoolCapacity = 1;
+  auto serviceProvider = serviceCollection.build(options);
+  const size_t memoryUsage = serviceProvider->memoryUsage();
+  bool failure = false;
+  IServiceProvider* pooledScope = nullptr;
+  for (int i = 0; i < 2; ++i) {
+    auto scope = serviceProvider->createScope();
+    auto unpooledScope = serviceProvider->createScope();
+    ASSERT_NE(scope.get(), unpooledScope.get());
+    if (pooledScope == nullptr) pooledScope = scope.get();
+    ASSERT_EQ(pooledScope, scope.get());
+    for (auto* sp : {scope.get(), unpooledScope.get()}) {
+      auto& service = sp->getRequiredService<DestructorTestClass3>();
+      ASSERT_TRUE(service._dependency._dependency._dependency._value.none());
+      service._dependency._dependency._dependency._failure = &failure;
+    }
+  }
+  ASSERT_FALSE(failure);
+  // the pooled scope keeps its slots
+  ASSERT_LE(memoryUsage + 4 * (sizeof(void*) + 3 * sizeof(size_t)),
+            serviceProvider->memoryUsage());
+}
+
+TEST(ServiceProviderTest, CanAllocateScopedServicesFromScopeArena) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addScoped<DestructorTestClass0>();
+  serviceCollection.addScoped<DestructorTestClass1>();
+  serviceCollection.addScoped<DestructorTestClass2>();
+  serviceCollection.addScoped<DestructorTestClass3>();
+  serviceCollection.addTransient<LeafService1>();
+  serviceCollection.addSingleton<ServiceWithTransientDependency>();
+  ServiceProviderOptions options;
+  options.scopePoolCapacity = 1;
+  options.scopeArenaSize = 64;
+  auto serviceProvider = serviceCollection.build(options);
+  bool failure = false;
+  ServiceWithTransientDependency* singleton = nullptr;
+  for (int i = 0; i < 3; ++i) {
+    auto scope = serviceProvider->createScope();
+    auto& service = scope->getRequiredService<DestructorTestClass3>();
+    ASSERT_TRUE(service._dependency._dependency._dependency._value.none());
+    service._dependency._dependency._dependency._failure = &failure;
+    ASSERT_EQ(1, scope->getRequiredTransientService<LeafService1>()->value);
+    auto* scopeSingleton = scope->getService<ServiceWithTransientDependency>();
+    if (singleton == nullptr) singleton = scopeSingleton;
+    ASSERT_EQ(singleton, scopeSingleton);
+  }
+  ASSERT_FALSE(failure);
+  ASSERT_EQ(1, singleton->_leafService->value);
+}
+
 struct LeafService2 {};
 struct LeafService3 {};
 struct LeafService4 {};
 
+TEST(ServiceProviderTest, ScopesOnlyHoldScopedServices) {
+  ServiceCollection fewSingletons;
+  fewSingletons.addSingleton<LeafService2>();
+  fewSingletons.addScoped<LeafService3>();
+  ServiceCollection manySingletons;
+  for (int i = 0; i < 64; ++i) manySingletons.addSingleton<LeafService2>();
+  manySingletons.addScoped<LeafService3>();
+  auto fewProvider = fewSingletons.build();
+  auto manyProvider = manySingletons.build();
+  ASSERT_GT(manyProvider->memoryUsage(),
+            fewProvider->memoryUsage() + 63 * 2 * sizeof(void*));
+  auto fewScope = fewProvider->createScope();
+  auto manyScope = manyProvider->createScope();
+  const size_t scopeMemoryUsage = fewScope->memoryUsage();
+  ASSERT_EQ(scopeMemoryUsage, manyScope->memoryUsage());
+  ASSERT_NE(nullptr, manyScope->getService<LeafService3>());
+  ASSERT_EQ(scopeMemoryUsage, manyScope->memoryUsage());
+  // sets of singletons are shared with the root service provider
+  ASSERT_EQ(64u, manyScope->getServiceSpan<LeafService2>().size());
+  ASSERT_EQ(scopeMemoryUsage, manyScope->memoryUsage());
+  ASSERT_EQ(1u, manyScope->getServiceSpan<LeafService3>().size());
+  ASSERT_LT(scopeMemoryUsage, manyScope->memoryUsage());
+}
+
+struct NumberedService {
+  inline static int numberOfInstances = 0;
+  int number = ++numberOfInstances;
+};
+
+TEST(ServiceProviderTest, ReleasesServiceSetsWithPooledScopes) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<LeafService2>();
+  serviceCollection.addScoped<NumberedService>();
+  ServiceProviderOptions options;
+  options.scopePoolCapacity = 1;
+  auto serviceProvider = serviceCollection.build(options);
+  const auto singletons = serviceProvider->getServiceSpan<LeafService2>();
+  for (int i = 0; i < 2; ++i) {
+    auto scope = serviceProvider->createScope();
+    ASSERT_TRUE(singletons.begin() ==
+                scope->getServiceSpan<LeafService2>().begin());
+    const auto services = scope->getServiceSpan<NumberedService>();
+    ASSERT_EQ(1u, services.size());
+    ASSERT_EQ(&scope->getRequiredService<NumberedService>(), &services[0]);
+    ASSERT_EQ(NumberedService::numberOfInstances, services[0].number);
+  }
+  ASSERT_EQ(2, NumberedService::numberOfInstances);
+}
+
 struct ServiceWithMultipleDependencies1 {
   LeafService1& _leafService1;
   LeafService2& _leafService2;
@@ -461,6 +661,55 @@ struct Service2 : public IService {};
 
 struct Service3 : public IService {};
 
+TEST(ServiceProviderTest, ResolvesMultipleServicesInOneCall) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<LeafService1>();
+  serviceCollection.addScoped<LeafService2>();
+  serviceCollection.addTransient<LeafService3>();
+  serviceCollection.addSingleton<IService, Service1>();
+  serviceCollection.addSingleton<IService, Service2>();
+  auto serviceProvider = serviceCollection.build();
+  auto scope = serviceProvider->createScope();
+  auto [singleton, scoped, service] =
+      scope->resolve<LeafService1, LeafService2, IService>();
+  ASSERT_EQ(serviceProvider->getService<LeafService1>(), &singleton);
+  ASSERT_EQ(scope->getService<LeafService2>(), &scoped);
+  ASSERT_NE(nullptr, dynamic_cast<Service2*>(&service));
+  ASSERT_EQ(&scoped, &std::get<1>(scope->resolve<IService, LeafService2>()));
+  ASSERT_EQ(&service, &std::get<0>(serviceProvider->resolve<IService>()));
+  auto resolveMissing = [&serviceProvider] {
+    serviceProvider->resolve<LeafService1, ServiceWithDependency>();
+  };
+  ASSERT_THROW(resolveMissing(), std::logic_error);
+  auto resolveTransient = [&scope] { scope->resolve<LeafService3>(); };
+  ASSERT_THROW(resolveTransient(), std::logic_error);
+}
+
+TEST(ServiceProviderTest, ResolversResolveServicesOfTheirProvider) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<LeafService1>();
+  serviceCollection.addScoped<LeafService2>();
+  serviceCollection.addTransient<LeafService3>();
+  serviceCollection.addSingleton<IService, Service1>();
+  serviceCollection.addSingleton<IService, Service2>();
+  auto serviceProvider = serviceCollection.build();
+  auto scope = serviceProvider->createScope();
+  auto singleton = scope->getResolver<LeafService1>();
+  auto scoped = scope->getResolver<LeafService2>();
+  ASSERT_TRUE(singleton);
+  ASSERT_TRUE(scoped);
+  // resolving creates the services
+  ASSERT_EQ(&singleton(), serviceProvider->getService<LeafService1>());
+  ASSERT_EQ(&scoped(), scope->getService<LeafService2>());
+  ASSERT_EQ(&scoped(), &scoped());
+  ASSERT_NE(&scoped(), serviceProvider->getService<LeafService2>());
+  ASSERT_EQ(&singleton(), &serviceProvider->getResolver<LeafService1>()());
+  auto service = serviceProvider->getResolver<IService>();
+  ASSERT_NE(nullptr, dynamic_cast<Service2*>(&service()));
+  ASSERT_FALSE(serviceProvider->getResolver<LeafService3>());
+  ASSERT_FALSE(scope->getResolver<ServiceWithDependency>());
+}
+
 TEST(ServiceProviderTest, CanGetMultipleServicesForSameInterface) {
   ServiceCollection serviceCollection;
   serviceCollection.addSingleton<IService, Service1>();
@@ -503,6 +752,28 @@ TEST(ServiceProviderTest, QueryingNotAvailableServicesProvidesEmptyVector) {
   ASSERT_TRUE(res3.empty());
 }
 
+TEST(ServiceProviderTest, TypedAndDynamicLookupProvideSameService) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<IService, Service1>();
+  serviceCollection.addScoped<LeafService1>();
+  auto serviceProvider = serviceCollection.build();
+  auto scope = serviceProvider->createScope();
+  auto* service = serviceProvider->getService<IService>();
+  auto serviceAny =
+      serviceProvider->getService(std::type_index(typeid(IService)));
+  ASSERT_EQ(service,
+            &std::any_cast<std::reference_wrapper<IService>>(serviceAny).get());
+  auto* scoped = scope->getService<LeafService1>();
+  auto scopedAny = scope->getService(std::type_index(typeid(LeafService1)));
+  ASSERT_EQ(scoped, &std::any_cast<std::reference_wrapper<LeafService1>>(
+                        scopedAny)
+                        .get());
+  ASSERT_EQ(nullptr, serviceProvider->getService<LeafService2>());
+  ASSERT_FALSE(
+      serviceProvider->getService(std::type_index(typeid(LeafService2)))
+          .has_value());
+}
+
 struct ServiceRequestingVectorOfServices {
   ServiceVector<IService> _services;
   ServiceRequestingVectorOfServices(ServiceVector<IService>&& services)
@@ -521,6 +792,49 @@ TEST(ServiceProviderTest, CanInjectMultipleServices) {
   ASSERT_EQ(3, service._services.size());
 }
 
+struct ServiceRequestingSpanOfServices {
+  ServiceSpan<IService> _services;
+  ServiceRequestingSpanOfServices(ServiceSpan<IService> services)
+      : _services(services) {}
+};
+
+TEST(ServiceProviderTest, CanInjectSpanOfServices) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<IService, Service1>();
+  serviceCollection.addScoped<IService, Service2>();
+  serviceCollection.addScoped<ServiceRequestingSpanOfServices>();
+  auto serviceProvider = serviceCollection.build();
+  auto scope = serviceProvider->createScope();
+  auto& service = scope->getRequiredService<ServiceRequestingSpanOfServices>();
+  ASSERT_EQ(2, service._services.size());
+  ASSERT_EQ(serviceProvider->getService<Service1>(), nullptr);
+  ASSERT_NE(nullptr, dynamic_cast<Service1*>(&service._services[0]));
+  ASSERT_EQ(scope->getService<IService>(), &service._services[1]);
+}
+
+TEST(ServiceProviderTest, CachesServiceSpans) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<IService, Service1>();
+  serviceCollection.addSingleton<IService, Service2>();
+  serviceCollection.addTransient<IService, Service3>();
+  ServiceProviderOptions options;
+  options.scopePoolCapacity = 1;
+  auto serviceProvider = serviceCollection.build(options);
+  auto services = serviceProvider->getServiceSpan<IService>();
+  ASSERT_EQ(2, services.size());
+  ASSERT_EQ(&services[0], &serviceProvider->getServiceSpan<IService>()[0]);
+  auto vector = serviceProvider->getServices<IService>();
+  size_t index = 0;
+  for (auto& service : services) ASSERT_EQ(&service, &vector[index++].get());
+  {
+    auto scope = serviceProvider->createScope();
+    ASSERT_EQ(&services[1], &scope->getServiceSpan<IService>()[1]);
+  }
+  auto scope = serviceProvider->createScope();
+  ASSERT_EQ(2, scope->getServiceSpan<IService>().size());
+  ASSERT_TRUE(serviceProvider->getServiceSpan<Service1>().empty());
+}
+
 struct ServiceRequestingVectorOfTransientServices {
   std::vector<std::shared_ptr<IService>> _services;
   ServiceRequestingVectorOfTransientServices(
@@ -657,6 +971,35 @@ TEST(ServiceProviderTest, CanInjectInterface) {
   ASSERT_EQ(&consumer._myInterface, &interface);
 }
 
+struct IOtherInterface {
+  virtual ~IOtherInterface() = default;
+  int otherValue = 2;
+};
+class MultipleInterfacesImplementation : public MyImplementation,
+                                         public IOtherInterface {};
+
+TEST(ServiceProviderTest, AdjustsPointersToTheServiceType) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<IOtherInterface,
+                                 MultipleInterfacesImplementation>();
+  serviceCollection.addTransient<IOtherInterface,
+                                 MultipleInterfacesImplementation>();
+  auto sp = serviceCollection.build();
+  auto& singleton = sp->getRequiredService<IOtherInterface>();
+  ASSERT_EQ(2, singleton.otherValue);
+  ASSERT_NE(nullptr,
+            dynamic_cast<MultipleInterfacesImplementation*>(&singleton));
+  auto singletonAny = sp->getService(std::type_index(typeid(IOtherInterface)));
+  ASSERT_EQ(&singleton, &std::any_cast<std::reference_wrapper<IOtherInterface>>(
+                             singletonAny)
+                             .get());
+  auto transient = sp->getRequiredTransientService<IOtherInterface>();
+  ASSERT_EQ(2, transient->otherValue);
+  ASSERT_NE(nullptr,
+            std::dynamic_pointer_cast<MultipleInterfacesImplementation>(
+                transient));
+}
+
 struct InjectServiceProvider {
   IServiceProvider& _serviceProvider;
   InjectServiceProvider(IServiceProvider& serviceProvider)
@@ -697,6 +1040,30 @@ struct ServiceWithConstDependencies {
   ServiceWithConstDependencies(
       ServiceVector<const LeafService1>&& dependencies) {}
 };
+struct ServiceWithDeclaredConstructor {
+  using Inject = Ctor<const LeafService1&, std::shared_ptr<LeafService1>>;
+  const LeafService1* singleton = nullptr;
+  std::shared_ptr<LeafService1> transient;
+  ServiceWithDeclaredConstructor() = default;
+  ServiceWithDeclaredConstructor(const LeafService1& singleton,
+                                 std::shared_ptr<LeafService1> transient)
+      : singleton(&singleton), transient(std::move(transient)) {}
+};
+
+static_assert(numberOfConstructorArgs<ServiceWithDeclaredConstructor>() == 2);
+
+TEST(ServiceProviderTest, UsesDeclaredConstructorArguments) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<LeafService1>();
+  serviceCollection.addTransient<LeafService1>();
+  serviceCollection.addSingleton<ServiceWithDeclaredConstructor>();
+  auto serviceProvider = serviceCollection.build();
+  auto& service =
+      serviceProvider->getRequiredService<ServiceWithDeclaredConstructor>();
+  ASSERT_EQ(serviceProvider->getService<LeafService1>(), service.singleton);
+  ASSERT_NE(nullptr, service.transient);
+}
+
 TEST(ServiceProviderTest, CanInjectVectorOfConstReferences) {
   ServiceCollection serviceCollection;
   serviceCollection.addSingleton<ServiceWithConstDependencies>();
@@ -818,6 +1185,688 @@ TEST(ServiceProviderTest, CanInjectConvertedScoped) {
   ASSERT_NE(concrete1, concrete2);
 }
 
+struct ThrowingService {
+  ThrowingService(LeafService1& leafService) {
+    if (leafService.value++ == 1) throw std::runtime_error("first attempt");
+  }
+};
+
+TEST(ServiceProviderTest, RetriesSingletonCreationAfterException) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<LeafService1>();
+  serviceCollection.addSingleton<ThrowingService>();
+  auto sp = serviceCollection.build();
+  ASSERT_THROW(sp->getService<ThrowingService>(), std::runtime_error);
+  auto* service = sp->getService<ThrowingService>();
+  ASSERT_NE(nullptr, service);
+  ASSERT_EQ(service, sp->getService<ThrowingService>());
+}
+
+TEST(ServiceProviderTest, ProvidersBuiltFromOneCollectionAreIndependent) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<LeafService1>();
+  auto sp1 = serviceCollection.build();
+  auto sp2 = serviceCollection.build();
+  serviceCollection.addSingleton<ServiceWithDependency>();
+  auto sp3 = std::move(serviceCollection).build();
+  ASSERT_NE(sp1->getService<LeafService1>(), sp2->getService<LeafService1>());
+  ASSERT_EQ(nullptr, sp2->getService<ServiceWithDependency>());
+  auto* service = sp3->getService<ServiceWithDependency>();
+  ASSERT_NE(nullptr, service);
+  ASSERT_EQ(&service->_leafService, sp3->getService<LeafService1>());
+}
+
+TEST(ServiceProviderTest, ChildProvidersShareUnaffectedSingletons) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<LeafService1>();
+  serviceCollection.addSingleton<LeafService2>();
+  serviceCollection.addSingleton<ServiceWithDependency>();
+  auto parent = serviceCollection.build();
+  ServiceCollection overrides;
+  overrides.addSingleton<LeafService1>(
+      std::make_shared<LeafService1>(LeafService1{2}));
+  auto child = parent->createChild(overrides);
+  ASSERT_EQ(parent->getService<LeafService2>(),
+            child->getService<LeafService2>());
+  ASSERT_EQ(parent->getService<LeafService2>(),
+            child->createScope()->getService<LeafService2>());
+  auto& service = child->getRequiredService<ServiceWithDependency>();
+  ASSERT_NE(parent->getService<ServiceWithDependency>(), &service);
+  ASSERT_EQ(2, service._leafService.value);
+  ASSERT_EQ(1, parent->getRequiredService<LeafService1>().value);
+}
+
+struct ReplaceableService {
+  int value;
+  std::vector<int>* destroyed;
+  ReplaceableService(int value, std::vector<int>* destroyed)
+      : value(value), destroyed(destroyed) {}
+  ~ReplaceableService() { destroyed->push_back(value); }
+};
+
+struct ReplaceableServiceUser {
+  ReplaceableService& service;
+  explicit ReplaceableServiceUser(ReplaceableService& service)
+      : service(service) {}
+};
+
+TEST(ServiceProviderTest, DestructsReplacedSingletonsAfterOlderScopes) {
+  std::vector<int> destroyed;
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton([&destroyed](IServiceProvider&) {
+    return std::make_unique<ReplaceableService>(1, &destroyed);
+  });
+  ServiceProviderOptions options;
+  options.threadLocalSingletonCache = true;
+  {
+    auto serviceProvider = serviceCollection.build(options);
+    auto scope = serviceProvider->createScope();
+    ASSERT_EQ(1, scope->getRequiredService<ReplaceableService>().value);
+    serviceProvider->replaceSingleton(
+        std::make_shared<ReplaceableService>(2, &destroyed));
+    ASSERT_EQ(2, scope->getRequiredService<ReplaceableService>().value);
+    ASSERT_EQ(2, serviceProvider->createScope()
+                     ->getServiceSpan<ReplaceableService>()[0]
+                     .value);
+    // the scope may still use the replaced instance
+    ASSERT_TRUE(destroyed.empty());
+    scope.reset();
+    ASSERT_EQ(std::vector<int>{1}, destroyed);
+    serviceProvider->replaceSingleton(
+        std::make_shared<ReplaceableService>(3, &destroyed));
+    ASSERT_EQ((std::vector<int>{1, 2}), destroyed);
+    ASSERT_EQ(3, serviceProvider->createScope()
+                     ->getRequiredService<ReplaceableService>()
+                     .value);
+  }
+  ASSERT_EQ((std::vector<int>{1, 2, 3}), destroyed);
+}
+
+TEST(ServiceProviderTest, KeepsReplacedSingletonsOfOtherSingletons) {
+  std::vector<int> destroyed;
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton([&destroyed](IServiceProvider&) {
+    return std::make_unique<ReplaceableService>(1, &destroyed);
+  });
+  serviceCollection.addSingleton<ReplaceableServiceUser>();
+  {
+    auto serviceProvider = serviceCollection.build();
+    auto& user = serviceProvider->getRequiredService<ReplaceableServiceUser>();
+    serviceProvider->replaceSingleton(
+        std::make_shared<ReplaceableService>(2, &destroyed));
+    ASSERT_EQ(1, user.service.value);
+    ASSERT_TRUE(destroyed.empty());
+  }
+  // in place of the original instance, after the singleton using it
+  ASSERT_EQ((std::vector<int>{2, 1}), destroyed);
+}
+
+TEST(ServiceProviderTest, KeepsReplacedSingletonsOfFactoryFunctions) {
+  std::vector<int> destroyed;
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton([&destroyed](IServiceProvider&) {
+    return std::make_unique<ReplaceableService>(1, &destroyed);
+  });
+  serviceCollection.addSingleton([](IServiceProvider& serviceProvider) {
+    return std::make_unique<ReplaceableServiceUser>(
+        serviceProvider.getRequiredService<ReplaceableService>());
+  });
+  {
+    auto serviceProvider = serviceCollection.build();
+    auto& user = serviceProvider->createScope()
+                     ->getRequiredService<ReplaceableServiceUser>();
+    serviceProvider->replaceSingleton(
+        std::make_shared<ReplaceableService>(2, &destroyed));
+    ASSERT_EQ(1, user.service.value);
+    ASSERT_TRUE(destroyed.empty());
+    // only the instance the singleton was created with is kept
+    serviceProvider->replaceSingleton(
+        std::make_shared<ReplaceableService>(3, &destroyed));
+    ASSERT_EQ(std::vector<int>{2}, destroyed);
+  }
+  ASSERT_EQ((std::vector<int>{2, 3, 1}), destroyed);
+}
+
+TEST(ServiceProviderTest, KeepsReplacedSingletonsResolvedThroughRoot) {
+  for (bool threadLocalSingletonCache : {false, true}) {
+    std::vector<int> destroyed;
+    ServiceCollection serviceCollection;
+    serviceCollection.addSingleton([&destroyed](IServiceProvider&) {
+      return std::make_unique<ReplaceableService>(1, &destroyed);
+    });
+    ServiceProviderOptions options;
+    options.threadLocalSingletonCache = threadLocalSingletonCache;
+    {
+      auto serviceProvider = serviceCollection.build(options);
+      auto replace = [&](int value) {
+        serviceProvider->replaceSingleton(
+            std::make_shared<ReplaceableService>(value, &destroyed));
+      };
+      auto& service = serviceProvider->getRequiredService<ReplaceableService>();
+      replace(2);
+      ASSERT_EQ(1, service.value);
+      // only the instances that the root service provider handed out are kept
+      // until it is destroyed
+      replace(3);
+      ASSERT_EQ(std::vector<int>{2}, destroyed);
+      ASSERT_EQ(3, serviceProvider->createScope()
+                       ->getRequiredService<ReplaceableService>()
+                       .value);
+      for (int i = 0; i < 2; ++i)
+        ASSERT_EQ(
+            3, serviceProvider->getRequiredService<ReplaceableService>().value);
+      replace(4);
+      ASSERT_EQ(std::vector<int>{2}, destroyed);
+      // a resolver of the root may resolve any instance
+      auto resolver = serviceProvider->getResolver<ReplaceableService>();
+      replace(5);
+      replace(6);
+      ASSERT_EQ(6, resolver().value);
+      ASSERT_EQ(std::vector<int>{2}, destroyed);
+    }
+    ASSERT_EQ((std::vector<int>{2, 6, 5, 4, 3, 1}), destroyed);
+  }
+}
+
+TEST(ServiceProviderTest, OnlyReplacesSingletons) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<LeafService1>();
+  serviceCollection.addScoped<LeafService2>();
+  auto serviceProvider = serviceCollection.build();
+  ASSERT_THROW(
+      serviceProvider->replaceSingleton(std::make_shared<LeafService2>()),
+      std::logic_error);
+  ASSERT_THROW(
+      serviceProvider->replaceSingleton(std::make_shared<LeafService3>()),
+      std::logic_error);
+  ASSERT_THROW(
+      serviceProvider->replaceSingleton(std::shared_ptr<LeafService1>{}),
+      std::invalid_argument);
+  ServiceCollection asyncCollection;
+  asyncCollection.addAsyncSingleton<LeafService4>([](IServiceProvider&) {
+    return std::async(std::launch::deferred,
+                      [] { return std::make_unique<LeafService4>(); });
+  });
+  ASSERT_THROW(asyncCollection.build()->replaceSingleton(
+                   std::make_shared<LeafService4>()),
+               std::logic_error);
+  // a singleton that has not been created yet is created from the replacement
+  auto replacement = std::make_shared<LeafService1>(LeafService1{2});
+  serviceProvider->replaceSingleton(replacement);
+  ASSERT_EQ(replacement.get(), serviceProvider->getService<LeafService1>());
+}
+
+TEST(ServiceProviderTest, ResolvesAsyncSingletonsWithoutWaiting) {
+  std::promise<std::unique_ptr<LeafService1>> promise;
+  ServiceCollection serviceCollection;
+  serviceCollection.addAsyncSingleton<LeafService1>(
+      [&promise](IServiceProvider&) { return promise.get_future(); });
+  auto serviceProvider = serviceCollection.build();
+  auto future = serviceProvider->getServiceAsync<LeafService1>();
+  ASSERT_FALSE(future.isReady());
+  promise.set_value(std::make_unique<LeafService1>(LeafService1{3}));
+  ASSERT_TRUE(future.isReady());
+  ASSERT_EQ(3, future.get()->value);
+  ASSERT_EQ(future.get(), serviceProvider->getService<LeafService1>());
+  auto scope = serviceProvider->createScope();
+  ASSERT_EQ(future.get(), scope->getServiceAsync<LeafService1>().get());
+}
+
+struct AsyncDependency {
+  bool* destroyed = nullptr;
+  ~AsyncDependency() {
+    if (destroyed != nullptr) *destroyed = true;
+  }
+};
+
+struct AsyncService {
+  AsyncDependency& dependency;
+  bool* dependencyDestroyed = nullptr;
+  bool* destroyedFirst = nullptr;
+  explicit AsyncService(AsyncDependency& dependency) : dependency(dependency) {}
+  ~AsyncService() {
+    if (destroyedFirst != nullptr) *destroyedFirst = !*dependencyDestroyed;
+  }
+};
+
+TEST(ServiceProviderTest, DestructsAsyncSingletonsBeforeTheirDependencies) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<AsyncDependency>();
+  serviceCollection.addAsyncSingleton<AsyncService>(
+      [](IServiceProvider& serviceProvider) {
+        return std::async(std::launch::async, [&serviceProvider] {
+          return std::make_unique<AsyncService>(
+              serviceProvider.getRequiredService<AsyncDependency>());
+        });
+      });
+  bool dependencyDestroyed = false;
+  bool destroyedFirst = false;
+  {
+    auto serviceProvider = serviceCollection.build();
+    auto* service = serviceProvider->getServiceAsync<AsyncService>().get();
+    ASSERT_NE(nullptr, service);
+    service->dependency.destroyed = &dependencyDestroyed;
+    service->dependencyDestroyed = &dependencyDestroyed;
+    service->destroyedFirst = &destroyedFirst;
+  }
+  ASSERT_TRUE(destroyedFirst);
+}
+
+TEST(ServiceProviderTest, ResolvesDependenciesOfTransientsInRequestingScope) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addScoped<LeafService1>();
+  serviceCollection.addTransient<ServiceWithDependency>();
+  serviceCollection.addTransient<ServiceWithTransientDependency>();
+  auto sp = serviceCollection.build();
+  auto scope1 = sp->createScope();
+  auto scope2 = sp->createScope();
+  auto service1 = scope1->getTransientService<ServiceWithDependency>();
+  auto service2 = scope2->getTransientService<ServiceWithDependency>();
+  ASSERT_EQ(&service1->_leafService, scope1->getService<LeafService1>());
+  ASSERT_EQ(&service2->_leafService, scope2->getService<LeafService1>());
+  ASSERT_THROW(scope1->getTransientService<ServiceWithTransientDependency>(),
+               std::logic_error);
+}
+
+TEST(ServiceProviderTest, WarmUpCreatesAllSingletons) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<LeafService1>();
+  serviceCollection.addSingleton<ServiceWithDependency>();
+  serviceCollection.addTransient<ServiceWithTransientDependency>();
+  ServiceProviderOptions options;
+  options.warmUpThreads = 2;
+  auto sp = serviceCollection.build(options);
+  sp->getService<LeafService1>()->value = 2;
+  ASSERT_EQ(2, sp->getService<ServiceWithDependency>()->_leafService.value);
+}
+
+TEST(ServiceProviderTest, WarmUpRethrowsConstructorExceptions) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<LeafService1>();
+  serviceCollection.addSingleton<ThrowingService>();
+  auto sp = serviceCollection.build();
+  ASSERT_THROW(sp->warmUp(4), std::runtime_error);
+  sp->warmUp(4);
+  ASSERT_NE(nullptr, sp->getService<ThrowingService>());
+}
+
+TEST(ServiceProviderTest, ThreadLocalCacheProvidesSingletonsOfEachProvider) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<LeafService1>();
+  serviceCollection.addScoped<LeafService2>();
+  ServiceProviderOptions options;
+  options.threadLocalSingletonCache = true;
+  auto sp1 = serviceCollection.build(options);
+  auto scope1 = sp1->createScope();
+  auto* service1 = scope1->getService<LeafService1>();
+  ASSERT_EQ(service1, scope1->getService<LeafService1>());
+  ASSERT_EQ(service1, sp1->getService<LeafService1>());
+  auto sp2 = serviceCollection.build(options);
+  auto scope2 = sp2->createScope();
+  auto* service2 = scope2->getService<LeafService1>();
+  ASSERT_NE(service1, service2);
+  ASSERT_EQ(service1, scope1->getService<LeafService1>());
+  ASSERT_NE(scope1->getService<LeafService2>(),
+            scope2->getService<LeafService2>());
+  scope1.reset();
+  sp1.reset();
+  auto sp3 = serviceCollection.build(options);
+  ASSERT_NE(nullptr, sp3->getService<LeafService1>());
+  ASSERT_EQ(service2, scope2->getService<LeafService1>());
+}
+
+struct CyclicService2;
+struct CyclicService1 {
+  CyclicService1(CyclicService2&) {}
+};
+struct CyclicService2 {
+  CyclicService2(std::shared_ptr<CyclicService1>) {}
+};
+
+TEST(ServiceProviderTest, ValidatesDependenciesOnBuild) {
+  ServiceProviderOptions options;
+  options.validateOnBuild = true;
+  {
+    ServiceCollection serviceCollection;
+    serviceCollection.addSingleton<LeafService1>();
+    serviceCollection.addSingleton<ServiceWithDependency>();
+    serviceCollection.addTransient<ServiceWithTransientDependency>();
+    serviceCollection.addSingleton<ServiceRequestingVectorOfServices>();
+    ASSERT_THROW(serviceCollection.build(options), std::logic_error);
+    serviceCollection.addTransient<LeafService1>();
+    ASSERT_NO_THROW(serviceCollection.build(options));
+  }
+  {
+    ServiceCollection serviceCollection;
+    serviceCollection.addTransient<CyclicService1>();
+    serviceCollection.addSingleton<CyclicService2>();
+    ASSERT_NO_THROW(serviceCollection.build());
+    ASSERT_THROW(serviceCollection.build(options), std::logic_error);
+  }
+  {
+    ServiceCollection serviceCollection;
+    serviceCollection.addScoped<LeafService1>();
+    serviceCollection.addTransient<ServiceWithDependency>();
+    serviceCollection.addSingleton<ServiceWithTransientDependency>();
+    serviceCollection.addSingleton<ServiceWithDependency>();
+    try {
+      serviceCollection.build(options);
+      FAIL();
+    } catch (const std::logic_error& error) {
+      const std::string message = error.what();
+      ASSERT_NE(std::string::npos, message.find("captures"));
+      ASSERT_NE(std::string::npos, message.find("LeafService1"));
+      ASSERT_NE(std::string::npos, message.find("has not been registered"));
+    }
+  }
+}
+
+struct ServiceWithUniqueDependency {
+  std::unique_ptr<ServiceWithDependency> _dependency;
+  std::unique_ptr<IService> _service;
+  ServiceWithUniqueDependency(std::unique_ptr<ServiceWithDependency> dependency,
+                              std::unique_ptr<IService> service)
+      : _dependency(std::move(dependency)), _service(std::move(service)) {}
+};
+
+TEST(ServiceProviderTest, CanCreateUniqueTransientServices) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<LeafService1>();
+  serviceCollection.addUniqueTransient<ServiceWithDependency>();
+  serviceCollection.addUniqueTransient<IService, Service2>();
+  serviceCollection.addScoped<ServiceWithUniqueDependency>();
+  auto serviceProvider = serviceCollection.build();
+  std::unique_ptr<ServiceWithDependency> service =
+      serviceProvider->getUniqueService<ServiceWithDependency>();
+  ASSERT_NE(nullptr, service);
+  ASSERT_EQ(serviceProvider->getService<LeafService1>(),
+            &service->_leafService);
+  ASSERT_NE(service,
+            serviceProvider->getUniqueService<ServiceWithDependency>());
+  ASSERT_EQ(nullptr, serviceProvider->getUniqueService<LeafService1>());
+  ASSERT_EQ(nullptr, serviceProvider->getTransientService<IService>());
+  auto scope = serviceProvider->createScope();
+  auto& scoped = scope->getRequiredService<ServiceWithUniqueDependency>();
+  ASSERT_NE(nullptr, scoped._dependency);
+  ASSERT_NE(nullptr, dynamic_cast<Service2*>(scoped._service.get()));
+  ASSERT_NE(nullptr, scope->getUniqueService<IService>());
+}
+
+struct ServiceWithLazyDependency {
+  Lazy<ServiceWithDependency> _service;
+  Factory<LeafService2> _factory;
+  ServiceWithLazyDependency(Lazy<ServiceWithDependency> service,
+                            Factory<LeafService2> factory)
+      : _service(std::move(service)), _factory(std::move(factory)) {}
+};
+
+TEST(ServiceProviderTest, ResolvesLazyDependenciesOnFirstAccess) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<LeafService1>();
+  serviceCollection.addScoped<ServiceWithDependency>();
+  serviceCollection.addTransient<LeafService2>();
+  serviceCollection.addScoped<ServiceWithLazyDependency>();
+  auto serviceProvider = serviceCollection.build();
+  auto scope = serviceProvider->createScope();
+  auto& service = scope->getRequiredService<ServiceWithLazyDependency>();
+  ASSERT_FALSE(service._service.isResolved());
+  ASSERT_EQ(scope->getService<ServiceWithDependency>(),
+            &service._service.get());
+  ASSERT_TRUE(service._service.isResolved());
+  ASSERT_NE(serviceProvider->getService<ServiceWithDependency>(),
+            &*service._service);
+  auto leafService = service._factory();
+  ASSERT_NE(nullptr, leafService);
+  ASSERT_NE(leafService, service._factory());
+}
+
+struct LazyCyclicService2;
+struct LazyCyclicService1 {
+  Lazy<LazyCyclicService2> _service;
+  LazyCyclicService1(Lazy<LazyCyclicService2> service)
+      : _service(std::move(service)) {}
+};
+struct LazyCyclicService2 {
+  LazyCyclicService1& _service;
+  LazyCyclicService2(LazyCyclicService1& service) : _service(service) {}
+};
+
+TEST(ServiceProviderTest, LazyDependenciesBreakCircularDependencies) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<LazyCyclicService1>();
+  serviceCollection.addSingleton<LazyCyclicService2>();
+  ServiceProviderOptions options;
+  options.validateOnBuild = true;
+  options.warmUpThreads = 2;
+  auto serviceProvider = serviceCollection.build(options);
+  auto& service = serviceProvider->getRequiredService<LazyCyclicService1>();
+  ASSERT_EQ(&service, &service._service->_service);
+}
+
+TEST(ServiceProviderTest, ResolvesKeyedServices) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<IService, Service1>("eu");
+  serviceCollection.addSingleton<IService, Service2>("us");
+  serviceCollection.addSingleton<IService, Service3>();
+  serviceCollection.addScoped<LeafService1>("scoped");
+  serviceCollection.addTransient<IService, Service1>("eu");
+  auto serviceProvider = serviceCollection.build();
+  auto* eu = serviceProvider->getService<IService>("eu");
+  auto* us = serviceProvider->getService<IService, "us">();
+  ASSERT_NE(nullptr, dynamic_cast<Service1*>(eu));
+  ASSERT_NE(nullptr, dynamic_cast<Service2*>(us));
+  ASSERT_NE(nullptr,
+            dynamic_cast<Service3*>(serviceProvider->getService<IService>()));
+  ASSERT_EQ(nullptr, serviceProvider->getService<IService>("asia"));
+  ASSERT_EQ(3, serviceProvider->getServices<IService>().size());
+  const ServiceKey key("eu");
+  ASSERT_EQ(eu, &serviceProvider->getRequiredService<IService>(key));
+  auto* compileTimeKeyed = serviceProvider->getService<IService, "eu">();
+  ASSERT_EQ(eu, compileTimeKeyed);
+  ASSERT_NE(nullptr, serviceProvider->getTransientService<IService>(key));
+  auto transient = serviceProvider->getTransientService<IService, "us">();
+  ASSERT_EQ(nullptr, transient);
+  auto scope = serviceProvider->createScope();
+  auto* scoped = scope->getService<LeafService1, "scoped">();
+  ASSERT_NE(nullptr, scoped);
+  ASSERT_EQ(eu, scope->getService<IService>("eu"));
+}
+
+struct PooledService {
+  LeafService1& _leafService;
+  int uses = 0;
+  int resets = 0;
+  PooledService(LeafService1& leafService) : _leafService(leafService) {}
+  void reset() {
+    uses = 0;
+    ++resets;
+  }
+};
+
+TEST(ServiceProviderTest, ReusesPooledTransientServices) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<LeafService1>();
+  serviceCollection.addPooledTransient<PooledService>(2);
+  auto serviceProvider = serviceCollection.build();
+  PooledService* pooled = nullptr;
+  {
+    auto service = serviceProvider->getTransientService<PooledService>();
+    ASSERT_EQ(serviceProvider->getService<LeafService1>(),
+              &service->_leafService);
+    pooled = service.get();
+    service->uses = 1;
+  }
+  auto service1 = serviceProvider->getTransientService<PooledService>();
+  ASSERT_EQ(pooled, service1.get());
+  ASSERT_EQ(0, service1->uses);
+  ASSERT_EQ(1, service1->resets);
+  auto service2 = serviceProvider->getTransientService<PooledService>();
+  auto service3 = serviceProvider->getTransientService<PooledService>();
+  ASSERT_NE(service1, service2);
+  ASSERT_NE(service2, service3);
+  ASSERT_EQ(0, service3->resets);
+}
+
+TEST(ServiceProviderTest, SharesPooledTransientServicesWithScopes) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<LeafService1>();
+  serviceCollection.addPooledTransient<PooledService>(1);
+  auto serviceProvider = serviceCollection.build();
+  PooledService* pooled = nullptr;
+  {
+    auto scope = serviceProvider->createScope();
+    pooled = scope->getTransientService<PooledService>().get();
+  }
+  auto service = serviceProvider->getTransientService<PooledService>();
+  ASSERT_EQ(pooled, service.get());
+  serviceProvider.reset();
+  ASSERT_EQ(1, service->resets);
+}
+
+struct PooledServiceWithTransient {
+  std::shared_ptr<LeafService3> _leafService;
+  IServiceProvider& _serviceProvider;
+  PooledServiceWithTransient(std::shared_ptr<LeafService3> leafService,
+                             IServiceProvider& serviceProvider)
+      : _leafService(std::move(leafService)),
+        _serviceProvider(serviceProvider) {}
+};
+
+TEST(ServiceProviderTest, ConstructsPooledTransientServicesInRoot) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addTransient<LeafService3>();
+  serviceCollection.addPooledTransient<PooledServiceWithTransient>(1);
+  ServiceProviderOptions options;
+  options.scopeArenaSize = 4096;
+  auto serviceProvider = serviceCollection.build(options);
+  PooledServiceWithTransient* pooled = nullptr;
+  {
+    auto scope = serviceProvider->createScope();
+    auto service = scope->getTransientService<PooledServiceWithTransient>();
+    ASSERT_EQ(serviceProvider.get(), &service->_serviceProvider);
+    pooled = service.get();
+  }
+  // the arena of the scope has been released
+  auto service =
+      serviceProvider->getTransientService<PooledServiceWithTransient>();
+  ASSERT_EQ(pooled, service.get());
+  ASSERT_NE(nullptr, service->_leafService);
+  service.reset();
+  serviceProvider.reset();
+}
+
+#ifdef CPPINJECT_INSTRUMENTATION
+struct RecordingObserver : IResolutionObserver {
+  std::vector<ResolutionEvent> events;
+  void onResolution(const ResolutionEvent& event) final {
+    events.push_back(event);
+  }
+};
+
+TEST(ServiceProviderTest, ReportsResolutionsToObserver) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<LeafService1>();
+  serviceCollection.addTransient<ServiceWithDependency>();
+  auto observer = std::make_shared<RecordingObserver>();
+  ServiceProviderOptions options;
+  options.resolutionObserver = observer;
+  auto serviceProvider = serviceCollection.build(options);
+  serviceProvider->getTransientService<ServiceWithDependency>();
+  serviceProvider->getService<LeafService1>();
+  ASSERT_EQ(3, observer->events.size());
+  ASSERT_EQ(typeid(LeafService1), observer->events[0].service);
+  ASSERT_EQ(ServiceType::Singleton, observer->events[0].lifetime);
+  ASSERT_FALSE(observer->events[0].cacheHit);
+  ASSERT_EQ(typeid(std::shared_ptr<ServiceWithDependency>),
+            observer->events[1].service);
+  ASSERT_EQ(ServiceType::Transient, observer->events[1].lifetime);
+  ASSERT_FALSE(observer->events[1].cacheHit);
+  ASSERT_GE(observer->events[1].duration, observer->events[0].duration);
+  ASSERT_TRUE(observer->events[2].cacheHit);
+  ASSERT_EQ(std::this_thread::get_id(), observer->events[2].thread);
+}
+
+TEST(ServiceProviderTest, CountsResolutionsOfProviderAndScopes) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<LeafService1>();
+  serviceCollection.addScoped<LeafService2>();
+  auto serviceProvider = serviceCollection.build();
+  for (int i = 0; i < 2; ++i) {
+    auto scope = serviceProvider->createScope();
+    scope->getService<LeafService1>();
+    scope->getService<LeafService2>();
+    scope->getService<LeafService2>();
+  }
+  auto statistics = serviceProvider->statistics();
+  ASSERT_EQ(2, statistics.size());
+  for (const auto& service : statistics) {
+    if (service.lifetime == ServiceType::Singleton) {
+      ASSERT_EQ(2, service.resolutions);
+      ASSERT_EQ(1, service.creations);
+    } else {
+      ASSERT_EQ(4, service.resolutions);
+      ASSERT_EQ(2, service.creations);
+    }
+  }
+}
+#endif
+
+TEST(StaticServiceCollectionTest, ResolvesDependenciesAtCompileTime) {
+  using Services = StaticServiceCollection<
+      SingletonRegistration<ServiceWithDependency>,
+      TransientRegistration<LeafService1>, SingletonRegistration<LeafService1>,
+      TransientRegistration<ServiceWithTransientDependency>>;
+  auto serviceProvider = Services::build();
+  auto& service = serviceProvider->get<ServiceWithDependency>();
+  ASSERT_EQ(&serviceProvider->get<LeafService1>(), &service._leafService);
+  auto transient = serviceProvider->create<ServiceWithTransientDependency>();
+  ASSERT_NE(nullptr, transient->_leafService);
+  ASSERT_NE(&service._leafService, transient->_leafService.get());
+}
+
+TEST(StaticServiceCollectionTest, DestructsSingletonsInReversedCreationOrder) {
+  using Services =
+      StaticServiceCollection<SingletonRegistration<DestructorTestClass3>,
+                              SingletonRegistration<DestructorTestClass2>,
+                              SingletonRegistration<DestructorTestClass1>,
+                              SingletonRegistration<DestructorTestClass0>>;
+  bool failure = false;
+  {
+    auto serviceProvider = Services::build();
+    serviceProvider->get<DestructorTestClass0>()._failure = &failure;
+  }
+  ASSERT_FALSE(failure);
+}
+
+TEST(StaticServiceCollectionTest, ImplementsServiceProviderInterface) {
+  using Services =
+      StaticServiceCollection<SingletonRegistration<IService, Service1>,
+                              SingletonRegistration<IService, Service2>,
+                              TransientRegistration<LeafService1>,
+                              SingletonRegistration<ServiceWithDependency>,
+                              SingletonRegistration<LeafService1>>;
+  auto provider = Services::build();
+  IServiceProviderRoot& serviceProvider = *provider;
+  ASSERT_EQ(&provider->get<IService>(),
+            serviceProvider.getService<IService>());
+  ASSERT_NE(nullptr, dynamic_cast<Service2*>(&provider->get<IService>()));
+  ASSERT_EQ(2, serviceProvider.getServiceSpan<IService>().size());
+  ASSERT_EQ(2, serviceProvider.getServices<IService>().size());
+  ASSERT_NE(nullptr, serviceProvider.getTransientService<LeafService1>());
+  ASSERT_EQ(&provider->get<LeafService1>(),
+            serviceProvider.getService<LeafService1>());
+  ASSERT_EQ(nullptr, serviceProvider.getService<LeafService2>());
+  auto scope = serviceProvider.createScope();
+  ASSERT_EQ(&provider->get<ServiceWithDependency>(),
+            scope->getService<ServiceWithDependency>());
+  auto boxed = serviceProvider.getService(typeid(LeafService1));
+  ASSERT_EQ(&provider->get<LeafService1>(),
+            &std::any_cast<std::reference_wrapper<LeafService1>>(boxed).get());
+  ASSERT_EQ(&provider->get<IService>(),
+            &scope->getResolver<IService>()());
+  ASSERT_FALSE(serviceProvider.getResolver<LeafService2>());
+}
+
 static constexpr size_t numberOfConcurrencyTestIterations = 1000;
 static constexpr size_t numberOfConcurrentIterations = 32;
 
@@ -896,6 +1945,38 @@ TEST(ConcurrencyTest, CanHandleConcurrentGetServiceCalls) {
   }
 }
 
+TEST(ConcurrencyTest, DestructsConcurrentlyCreatedServicesInReversedOrder) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<DestructorTestClass0>();
+  serviceCollection.addSingleton<DestructorTestClass1>();
+  serviceCollection.addSingleton<DestructorTestClass2>();
+  serviceCollection.addSingleton<DestructorTestClass3>();
+
+  for (size_t i = 0; i < numberOfConcurrencyTestIterations; ++i) {
+    bool failure = false;
+    {
+      auto serviceProvider = serviceCollection.build();
+      std::atomic<bool> splinlock{false};
+      auto worker = [&serviceProvider, &splinlock](int j) {
+        while (!splinlock.load(std::memory_order_relaxed))
+          ;
+        if (j % 2 == 0)
+          serviceProvider->getRequiredService<DestructorTestClass3>();
+        else
+          serviceProvider->getRequiredService<DestructorTestClass1>();
+      };
+      std::vector<std::future<void>> futures;
+      for (int j = 0; j < 4; ++j)
+        futures.emplace_back(std::async(std::launch::async, worker, j));
+      splinlock.store(true, std::memory_order_relaxed);
+      for (auto& future : futures) future.get();
+      serviceProvider->getRequiredService<DestructorTestClass0>()._failure =
+          &failure;
+    }
+    ASSERT_FALSE(failure);
+  }
+}
+
 TEST(ConcurrencyTest, CanHandleConcurrentScopedGetServiceCalls) {
   ServiceCollection serviceCollection;
   serviceCollection.addSingleton<LeafService1>();
@@ -967,4 +2048,112 @@ TEST(ConcurrencyTest, CanHandleConcurrentScopedGetServiceCalls) {
   }
 }
 
+TEST(ConcurrencyTest, CanHandleMixedRequestsWhileScopesAreCreated) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton<LeafService1>();
+  serviceCollection.addSingleton<LeafService2>();
+  serviceCollection.addTransient<LeafService3>();
+  serviceCollection.addTransient<LeafService4>();
+  serviceCollection.addSingleton<ServiceWithMultipleDependencies1>();
+  serviceCollection.addScoped<ServiceWithMultipleDependencies2>();
+  serviceCollection.addScoped<ServiceWithMultipleDependencies3>();
+  constexpr size_t numberOfWorkers = 8;
+  constexpr size_t numberOfRequests = 100;
+
+  for (size_t i = 0; i < numberOfConcurrencyTestIterations; ++i) {
+    auto serviceProvider = serviceCollection.build();
+    std::atomic<bool> splinlock{false};
+
+    // every request creates a scope, so the pooled scopes are reused by
+    // different threads, while the singletons are created concurrently
+    auto worker = [&serviceProvider,
+                   &splinlock]() -> ServiceWithMultipleDependencies1* {
+      while (!splinlock.load(std::memory_order_relaxed))
+        ;
+      ServiceWithMultipleDependencies1* singleton = nullptr;
+      for (size_t j = 0; j < numberOfRequests; ++j) {
+        auto scope = serviceProvider->createScope(
+            j % 2 == 0 ? ScopeMode::Concurrent : ScopeMode::SingleThreaded);
+        auto& root =
+            scope->getRequiredService<ServiceWithMultipleDependencies3>();
+        auto& scoped =
+            scope->getRequiredService<ServiceWithMultipleDependencies2>();
+        auto& shared =
+            scope->getRequiredService<ServiceWithMultipleDependencies1>();
+        auto transient = scope->getTransientService<LeafService3>();
+        if (&root._serviceWithMultipleDependencies2 != &scoped ||
+            &scoped._serviceWithMultipleDependencies1 != &shared ||
+            transient == nullptr || transient == scoped._leafService3 ||
+            (singleton != nullptr && singleton != &shared))
+          return nullptr;
+        singleton = &shared;
+      }
+      return singleton;
+    };
+
+    std::vector<std::future<ServiceWithMultipleDependencies1*>> results;
+    results.reserve(numberOfWorkers);
+    for (size_t j = 0; j < numberOfWorkers; ++j)
+      results.emplace_back(std::async(std::launch::async, worker));
+    splinlock.store(true, std::memory_order_relaxed);
+
+    auto& singleton =
+        serviceProvider->getRequiredService<ServiceWithMultipleDependencies1>();
+    for (auto& result : results) ASSERT_EQ(&singleton, result.get());
+  }
+}
+
+struct ReplacedConcurrently {
+  inline static std::atomic<int> instances{0};
+  int generation;
+  explicit ReplacedConcurrently(int generation) : generation(generation) {
+    ++instances;
+  }
+  ~ReplacedConcurrently() { --instances; }
+};
+
+TEST(ConcurrencyTest, CanReplaceSingletonsWhileScopesUseThem) {
+  ServiceCollection serviceCollection;
+  serviceCollection.addSingleton([](IServiceProvider&) {
+    return std::make_unique<ReplacedConcurrently>(0);
+  });
+  serviceCollection.addScoped<LeafService2>();
+  constexpr int numberOfReplacements = 1000;
+  {
+    auto serviceProvider = serviceCollection.build();
+    std::atomic<bool> replaced{false};
+
+    auto worker = [&serviceProvider, &replaced]() {
+      int generation = 0;
+      while (!replaced.load(std::memory_order_relaxed)) {
+        auto scope = serviceProvider->createScope();
+        scope->getRequiredService<LeafService2>();
+        const int current =
+            scope->getRequiredService<ReplacedConcurrently>().generation;
+        // replacements are visible in order
+        if (current < generation) return false;
+        generation = current;
+      }
+      return true;
+    };
+
+    std::vector<std::future<bool>> results;
+    for (int j = 0; j < 4; ++j)
+      results.emplace_back(std::async(std::launch::async, worker));
+    for (int j = 1; j <= numberOfReplacements; ++j) {
+      serviceProvider->replaceSingleton(
+          std::make_shared<ReplacedConcurrently>(j));
+      std::this_thread::yield();
+    }
+    replaced.store(true, std::memory_order_relaxed);
+    for (auto& result : results) ASSERT_TRUE(result.get());
+    ASSERT_EQ(numberOfReplacements,
+              serviceProvider->getRequiredService<ReplacedConcurrently>()
+                  .generation);
+    // all scopes have been released
+    ASSERT_EQ(1, ReplacedConcurrently::instances.load());
+  }
+  ASSERT_EQ(0, ReplacedConcurrently::instances.load());
+}
+
 }  // namespace DependencyInjectionTest